@@ -0,0 +1,506 @@
+/// @file benchmark_suite.cpp
+///
+/// Regression suite for prqueue.h in the style of Google Benchmark. Every
+/// operation is timed for each engine, payload type, priority distribution
+/// and size from 10^3 to 10^7, and the results can be saved as JSON to
+/// compare builds. Cases are named
+///
+///     <operation>/<engine>/<distribution>/<payload>/<size>
+///
+/// and take the usual Google Benchmark flags:
+///
+///     --benchmark_filter=<regex>     run the cases whose name matches
+///     --benchmark_min_time=<secs>    repeat each case for at least this long
+///     --benchmark_format=console|json
+///     --benchmark_out=<file>         also write JSON results to <file>
+///     --benchmark_list_tests         print the case names and exit
+///
+/// A full run takes a long time; pick a slice with the filter, e.g.
+///
+///     g++ -std=c++17 -O2 benchmark_suite.cpp -o benchmark_suite
+///     ./benchmark_suite --benchmark_filter='red_black/random/int' --benchmark_out=before.json
+///
+
+#include "prqueue.h"
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+// Results are folded in here so the optimizer cannot drop the work
+volatile long long benchSink = 0;
+
+// 256-byte payload
+struct Blob256 {
+    long long id;
+    char bytes[248];
+
+    explicit Blob256(long long id = 0) : id(id) {
+        memset(bytes, 0, sizeof(bytes));
+    }
+
+    bool operator==(const Blob256& other) const {
+        return id == other.id && memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+    }
+
+    bool operator!=(const Blob256& other) const {
+        return !(*this == other);
+    }
+};
+
+ostream& operator<<(ostream& out, const Blob256& blob) {
+    return out << "blob " << blob.id;
+}
+
+// How the priorities of a run are drawn
+struct Distribution {
+    const char* name;
+    bool sorted;     // Ascending or descending
+    int distinct;    // Distinct priorities, 0 for one per element
+};
+
+const Distribution distributions[] = {
+    {"ascending", true, 0},
+    {"descending", true, 0},
+    {"random", false, 0},
+    {"duplicates", false, -64},  // About 64 elements per priority
+    {"few", false, 8},
+};
+
+const int sizes[] = {1000, 10000, 100000, 1000000, 10000000};
+
+const char* const operations[] = {
+    "enqueue", "dequeue", "peek", "next", "toString", "copy_assign", "equal",
+};
+
+vector<int> makePriorities(const Distribution& dist, int n) {
+    vector<int> priorities(n);
+    mt19937 rng(12345);
+    int distinct = dist.distinct < 0 ? max(1, n / -dist.distinct) : dist.distinct;
+    for (int i = 0; i < n; i++) {
+        if (dist.sorted) {
+            priorities[i] = dist.name[0] == 'a' ? i : n - i;
+        } else if (distinct > 0) {
+            priorities[i] = int(rng() % unsigned(distinct));
+        } else {
+            priorities[i] = int(rng() % 1000000000);
+        }
+    }
+    return priorities;
+}
+
+// Payload types and how to build the i-th value
+template<typename T>
+struct Payload;
+
+template<>
+struct Payload<int> {
+    static constexpr const char* name = "int";
+    static constexpr size_t heapBytes = 0;
+    static int make(int i) {
+        return i;
+    }
+};
+
+template<>
+struct Payload<string> {
+    static constexpr const char* name = "string";
+    static constexpr size_t heapBytes = 32;  // Too long for the small-string buffer
+    static string make(int i) {
+        return "payload-" + to_string(1000000000 + i);
+    }
+};
+
+template<>
+struct Payload<Blob256> {
+    static constexpr const char* name = "blob256";
+    static constexpr size_t heapBytes = 0;
+    static Blob256 make(int i) {
+        return Blob256(i);
+    }
+};
+
+// Engines under test
+template<typename Engine>
+struct EngineName;
+template<> struct EngineName<prq::bst> { static constexpr const char* name = "bst"; };
+template<> struct EngineName<prq::red_black> { static constexpr const char* name = "red_black"; };
+template<> struct EngineName<prq::ranked> { static constexpr const char* name = "ranked"; };
+template<> struct EngineName<prq::dary_heap<4>> { static constexpr const char* name = "dary_heap4"; };
+template<> struct EngineName<prq::compact> { static constexpr const char* name = "compact"; };
+template<> struct EngineName<prq::persistent> { static constexpr const char* name = "persistent"; };
+
+// Why a case cannot finish in reasonable time on this engine, or nullptr
+template<typename Engine>
+const char* tooSlow(const Distribution& dist, int n) {
+    if (is_same_v<Engine, prq::bst> && dist.sorted && n > 10000) {
+        return "plain BST is quadratic on sorted priorities";
+    }
+    return nullptr;
+}
+
+const double memoryBudget = 3.0 * (1 << 30);
+
+// Bytes a case needs for the source values and `queues` filled queues
+template<typename T>
+double footprint(int n, int queues) {
+    double element = double(sizeof(T) + Payload<T>::heapBytes);
+    return n * (element + queues * (element + 48.0) + sizeof(int));
+}
+
+double cpuNow() {
+    return double(clock()) / CLOCKS_PER_SEC;
+}
+
+// Measured time of one case, accumulated over its iterations
+struct Timer {
+    double real = 0;
+    double cpu = 0;
+
+    template<typename F>
+    void time(F work) {
+        double cpuStart = cpuNow();
+        auto start = chrono::steady_clock::now();
+        work();
+        auto stop = chrono::steady_clock::now();
+        cpu += cpuNow() - cpuStart;
+        real += chrono::duration<double>(stop - start).count();
+    }
+};
+
+struct Result {
+    string name;
+    long long iterations;
+    long long items;     // Elements handled per iteration
+    double realSeconds;  // Per iteration
+    double cpuSeconds;
+    string skipped;      // Reason the case did not run, empty if it did
+};
+
+string jsonString(const string& text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (unsigned(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", unsigned(c));
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+class Suite {
+public:
+    regex filter{"."};
+    double minTime = 0.1;
+    bool listOnly = false;
+    bool jsonConsole = false;
+    string outPath;
+    string executable;
+
+    bool wants(const string& name) const {
+        return regex_search(name, filter);
+    }
+
+    // Runs iteration(timer) until the timed part adds up to minTime
+    template<typename F>
+    void run(const string& name, long long items, F iteration) {
+        if (listOnly) {
+            printf("%s\n", name.c_str());
+            return;
+        }
+        Timer timer;
+        long long iterations = 0;
+        do {
+            iteration(timer);
+            iterations++;
+        } while (timer.real < minTime && iterations < 1000000000);
+        record({name, iterations, items, timer.real / iterations, timer.cpu / iterations, ""});
+    }
+
+    void skip(const string& name, const string& reason) {
+        if (listOnly) {
+            printf("%s\n", name.c_str());
+            return;
+        }
+        record({name, 0, 0, 0, 0, reason});
+    }
+
+    void header() {
+        if (!listOnly && !jsonConsole) {
+            printf("%-52s %14s %14s %12s %12s\n", "Benchmark", "Time", "CPU", "Iterations", "ns/item");
+            printf("%s\n", string(108, '-').c_str());
+        }
+    }
+
+    // Writes the JSON report to --benchmark_out and/or the console
+    bool finish() {
+        if (listOnly) {
+            return true;
+        }
+        string json = report();
+        if (jsonConsole) {
+            fwrite(json.data(), 1, json.size(), stdout);
+        }
+        if (!outPath.empty()) {
+            ofstream out(outPath);
+            out << json;
+            if (!out) {
+                fprintf(stderr, "cannot write %s\n", outPath.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    vector<Result> results;
+
+    void record(const Result& result) {
+        results.push_back(result);
+        if (jsonConsole) {
+            return;
+        }
+        if (!result.skipped.empty()) {
+            printf("%-52s skipped: %s\n", result.name.c_str(), result.skipped.c_str());
+        } else {
+            printf("%-52s %11.0f ns %11.0f ns %12lld %12.1f\n", result.name.c_str(),
+                   result.realSeconds * 1e9, result.cpuSeconds * 1e9, result.iterations,
+                   result.realSeconds * 1e9 / double(result.items));
+        }
+        fflush(stdout);
+    }
+
+    string report() const {
+        char date[64];
+        time_t now = time(nullptr);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+        char host[256] = "";
+        gethostname(host, sizeof(host) - 1);
+
+        string json = "{\n  \"context\": {\n";
+        json += "    \"date\": " + jsonString(date) + ",\n";
+        json += "    \"host_name\": " + jsonString(host) + ",\n";
+        json += "    \"executable\": " + jsonString(executable) + ",\n";
+        json += "    \"num_cpus\": " + to_string(thread::hardware_concurrency()) + ",\n";
+#ifdef NDEBUG
+        json += "    \"library_build_type\": \"release\"\n";
+#else
+        json += "    \"library_build_type\": \"debug\"\n";
+#endif
+        json += "  },\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& result = results[i];
+            char numbers[256];
+            json += i ? ",\n" : "\n";
+            json += "    {\n      \"name\": " + jsonString(result.name) + ",\n";
+            json += "      \"run_name\": " + jsonString(result.name) + ",\n";
+            json += "      \"run_type\": \"iteration\",\n";
+            if (!result.skipped.empty()) {
+                json += "      \"error_occurred\": true,\n";
+                json += "      \"error_message\": " + jsonString(result.skipped) + "\n    }";
+                continue;
+            }
+            snprintf(numbers, sizeof(numbers),
+                     "      \"iterations\": %lld,\n"
+                     "      \"real_time\": %.6e,\n"
+                     "      \"cpu_time\": %.6e,\n"
+                     "      \"time_unit\": \"ns\",\n"
+                     "      \"items_per_second\": %.6e\n    }",
+                     result.iterations, result.realSeconds * 1e9, result.cpuSeconds * 1e9,
+                     result.realSeconds > 0 ? double(result.items) / result.realSeconds : 0.0);
+            json += numbers;
+        }
+        json += "\n  ]\n}\n";
+        return json;
+    }
+};
+
+// Every operation on one engine, payload, distribution and size. The
+// read-only operations share one filled queue.
+template<typename T, typename Engine>
+void runCases(Suite& suite, const Distribution& dist, int n) {
+    using Queue = prqueue<T, int, less<int>, Engine>;
+    string suffix = string("/") + EngineName<Engine>::name + "/" + dist.name + "/" +
+                    Payload<T>::name + "/" + to_string(n);
+
+    vector<string> selected;
+    for (const char* op : operations) {
+        if (suite.wants(op + suffix)) {
+            selected.push_back(op);
+        }
+    }
+    if (selected.empty()) {
+        return;
+    }
+    if (suite.listOnly) {
+        for (const string& op : selected) {
+            suite.skip(op + suffix, "");
+        }
+        return;
+    }
+    if (const char* reason = tooSlow<Engine>(dist, n)) {
+        for (const string& op : selected) {
+            suite.skip(op + suffix, reason);
+        }
+        return;
+    }
+
+    vector<int> priorities = makePriorities(dist, n);
+    vector<T> values;
+    values.reserve(n);
+    for (int i = 0; i < n; i++) {
+        values.push_back(Payload<T>::make(i));
+    }
+    auto fill = [&](Queue& pq) {
+        for (int i = 0; i < n; i++) {
+            pq.enqueue(values[i], priorities[i]);
+        }
+    };
+
+    unique_ptr<Queue> filled;
+    for (const string& op : selected) {
+        string name = op + suffix;
+        int queues = (op == "copy_assign" || op == "equal") ? 2 : 1;
+        if (footprint<T>(n, queues) > memoryBudget) {
+            suite.skip(name, "needs about " + to_string(long(footprint<T>(n, queues) / (1 << 20))) + " MiB");
+            continue;
+        }
+
+        if (op == "enqueue") {
+            suite.run(name, n, [&](Timer& timer) {
+                Queue pq;
+                timer.time([&] { fill(pq); });
+            });
+            continue;
+        }
+        if (op == "dequeue") {
+            suite.run(name, n, [&](Timer& timer) {
+                Queue pq;
+                fill(pq);
+                timer.time([&] {
+                    while (pq.size() > 0) {
+                        benchSink += pq.peekPriority();
+                        pq.dequeue();
+                    }
+                });
+            });
+            continue;
+        }
+
+        if (!filled) {
+            filled = make_unique<Queue>();
+            fill(*filled);
+        }
+        Queue& pq = *filled;
+        if (op == "peek") {
+            suite.run(name, n, [&](Timer& timer) {
+                timer.time([&] {
+                    for (int i = 0; i < n; i++) {
+                        benchSink += pq.peekPriority() + (&pq.peek() == nullptr);
+                    }
+                });
+            });
+        } else if (op == "next") {
+            suite.run(name, n, [&](Timer& timer) {
+                timer.time([&] {
+                    T value{};
+                    int priority = 0;
+                    pq.begin();
+                    for (bool more = pq.size() > 0; more; ) {
+                        more = pq.next(value, priority);
+                        benchSink += priority;
+                    }
+                });
+            });
+        } else if (op == "toString") {
+            suite.run(name, n, [&](Timer& timer) {
+                timer.time([&] {
+                    benchSink += pq.toString().size();
+                });
+            });
+        } else if (op == "copy_assign") {
+            suite.run(name, n, [&](Timer& timer) {
+                Queue copy;
+                timer.time([&] {
+                    copy = pq;
+                });
+            });
+        } else if (op == "equal") {
+            Queue copy(pq);
+            suite.run(name, n, [&](Timer& timer) {
+                timer.time([&] {
+                    benchSink += (pq == copy);
+                });
+            });
+        }
+    }
+}
+
+template<typename Engine>
+void runEngine(Suite& suite) {
+    for (const Distribution& dist : distributions) {
+        for (int n : sizes) {
+            runCases<int, Engine>(suite, dist, n);
+            runCases<string, Engine>(suite, dist, n);
+            runCases<Blob256, Engine>(suite, dist, n);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Suite suite;
+    suite.executable = argv[0];
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        auto value = [&](const string& flag) {
+            return arg.compare(0, flag.size(), flag) == 0 ? arg.substr(flag.size()) : string();
+        };
+        try {
+            if (!value("--benchmark_filter=").empty()) {
+                suite.filter = regex(value("--benchmark_filter="));
+            } else if (!value("--benchmark_min_time=").empty()) {
+                suite.minTime = stod(value("--benchmark_min_time="));
+            } else if (arg == "--benchmark_format=json") {
+                suite.jsonConsole = true;
+            } else if (arg == "--benchmark_format=console") {
+                suite.jsonConsole = false;
+            } else if (!value("--benchmark_out=").empty()) {
+                suite.outPath = value("--benchmark_out=");
+            } else if (arg == "--benchmark_list_tests" || arg == "--benchmark_list_tests=true") {
+                suite.listOnly = true;
+            } else {
+                fprintf(stderr, "unknown argument %s\n", arg.c_str());
+                return 2;
+            }
+        } catch (const exception& error) {
+            fprintf(stderr, "bad argument %s: %s\n", arg.c_str(), error.what());
+            return 2;
+        }
+    }
+
+    suite.header();
+    runEngine<prq::bst>(suite);
+    runEngine<prq::red_black>(suite);
+    runEngine<prq::ranked>(suite);
+    runEngine<prq::dary_heap<4>>(suite);
+    runEngine<prq::compact>(suite);
+    runEngine<prq::persistent>(suite);
+    return suite.finish() ? 0 : 1;
+}
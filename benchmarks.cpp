@@ -0,0 +1,1296 @@
+/// @file benchmarks.cpp
+///
+/// Timing runs for prqueue.h. Every benchmark is a small function
+/// registered in the table at the bottom of the file; run them all
+/// with no arguments or pick some by name:
+///
+///     g++ -std=c++17 -O2 benchmarks.cpp -o benchmarks
+///     ./benchmarks balance
+///
+
+#include "prqueue.h"
+
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Seconds elapsed while running `work` once
+template<typename F>
+double timeIt(F work) {
+    auto start = chrono::steady_clock::now();
+    work();
+    auto stop = chrono::steady_clock::now();
+    return chrono::duration<double>(stop - start).count();
+}
+
+// Results are folded in here so the optimizer cannot drop the work
+volatile long long benchSink = 0;
+
+// Priority streams used by several benchmarks
+vector<int> ascendingPriorities(int n) {
+    vector<int> priorities(n);
+    for (int i = 0; i < n; i++) {
+        priorities[i] = i;
+    }
+    return priorities;
+}
+
+vector<int> descendingPriorities(int n) {
+    vector<int> priorities(n);
+    for (int i = 0; i < n; i++) {
+        priorities[i] = n - i;
+    }
+    return priorities;
+}
+
+vector<int> randomPriorities(int n) {
+    mt19937 rng(12345);
+    vector<int> priorities(n);
+    for (int i = 0; i < n; i++) {
+        priorities[i] = int(rng() % 1000000000);
+    }
+    return priorities;
+}
+
+void printRow(const string& name, int n, double seconds) {
+    printf("  %-34s n=%-9d %10.3f ms %10.1f ns/op\n",
+           name.c_str(), n, seconds * 1e3, seconds * 1e9 / n);
+}
+
+// Hardware event counter for this thread, read through perf_event_open.
+// Where the kernel or container forbids it, stop() returns -1.
+class PerfCounter {
+public:
+    explicit PerfCounter(unsigned long long event) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = event;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    ~PerfCounter() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    void start() {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    long long stop() {
+        long long count = -1;
+        if (fd < 0) {
+            return count;
+        }
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+            return -1;
+        }
+        return count;
+    }
+
+private:
+    int fd;
+};
+
+// printRow plus cache misses per operation ("n/a" without perf counters)
+void printMissRow(const string& name, int n, double seconds, long long misses) {
+    if (misses < 0) {
+        printf("  %-34s n=%-9d %10.3f ms %10.1f ns/op %10s\n",
+               name.c_str(), n, seconds * 1e3, seconds * 1e9 / n, "n/a");
+    } else {
+        printf("  %-34s n=%-9d %10.3f ms %10.1f ns/op %7.2f miss/op\n",
+               name.c_str(), n, seconds * 1e3, seconds * 1e9 / n, double(misses) / n);
+    }
+}
+
+// Enqueue then drain a whole priority stream
+template<typename Engine>
+void runFill(const string& name, const vector<int>& priorities) {
+    prqueue<int, int, less<int>, Engine> pq;
+    int n = int(priorities.size());
+
+    double in = timeIt([&] {
+        for (int i = 0; i < n; i++) {
+            pq.enqueue(i, priorities[i]);
+        }
+    });
+    double out = timeIt([&] {
+        while (pq.size() > 0) {
+            pq.dequeue();
+        }
+    });
+    printRow(name + " enqueue", n, in);
+    printRow(name + " dequeue", n, out);
+}
+
+// Balanced vs plain tree on ascending, descending and random streams.
+// Sorted streams degrade the plain BST to O(n^2), so it only gets a
+// slice of them; the ns/op column is what to compare.
+void benchBalance() {
+    const int n = 1000000;
+    const int slice = 20000;
+
+    runFill<prq::red_black>("red_black ascending", ascendingPriorities(n));
+    runFill<prq::bst>("bst ascending", ascendingPriorities(slice));
+    runFill<prq::red_black>("red_black descending", descendingPriorities(n));
+    runFill<prq::bst>("bst descending", descendingPriorities(slice));
+    runFill<prq::red_black>("red_black random", randomPriorities(n));
+    runFill<prq::bst>("bst random", randomPriorities(n));
+}
+
+// Peek then dequeue until empty, the consumer loop of a typical worker
+template<typename Engine>
+void runConsume(const string& name, const vector<int>& priorities) {
+    prqueue<int, int, less<int>, Engine> pq;
+    int n = int(priorities.size());
+    for (int i = 0; i < n; i++) {
+        pq.enqueue(i, priorities[i]);
+    }
+
+    double seconds = timeIt([&] {
+        while (pq.size() > 0) {
+            benchSink += pq.peek();
+            benchSink += pq.dequeue();
+        }
+    });
+    printRow(name + " peek+dequeue", n, seconds);
+}
+
+// Peek/dequeue cost across tree depths: the descending bst is one long
+// left spine (depth n), the others are O(log n) deep.
+void benchMinimum() {
+    for (int n = 1000; n <= 1000000; n *= 10) {
+        runConsume<prq::bst>("bst descending", descendingPriorities(n));
+        runConsume<prq::bst>("bst random", randomPriorities(n));
+        runConsume<prq::red_black>("red_black random", randomPriorities(n));
+    }
+}
+
+// Resident set size of this process in MiB
+double residentMiB() {
+    long pages = 0;
+    long resident = 0;
+    ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return double(resident) * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+// Run `work` in a forked child so each configuration starts from a clean heap
+template<typename F>
+void inChild(F work) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        work();
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(child, nullptr, 0);
+}
+
+// Fill to `steady` elements, then alternate enqueue/dequeue
+template<typename Alloc>
+void runChurn(const string& name, int steady, int ops) {
+    inChild([&] {
+        mt19937 rng(7);
+        double before = residentMiB();
+        prqueue<int, int, less<int>, prq::red_black, Alloc> pq;
+        for (int i = 0; i < steady; i++) {
+            pq.enqueue(i, int(rng() % 1000000));
+        }
+        double seconds = timeIt([&] {
+            for (int i = 0; i < ops; i++) {
+                pq.enqueue(i, int(rng() % 1000000));
+                benchSink += pq.dequeue();
+            }
+        });
+        printf("  %-16s steady=%-9d %8.2f Mops/s %8.1f MiB RSS\n",
+               name.c_str(), steady, ops / seconds / 1e6, residentMiB() - before);
+    });
+}
+
+// Interleaved enqueue/dequeue at a steady size: pooled slab vs new/delete
+void benchChurn() {
+    const int ops = 2000000;
+    for (int steady = 100000; steady <= 10000000; steady *= 10) {
+        runChurn<allocator<int>>("new/delete", steady, ops);
+        runChurn<prq::pool_allocator<int>>("pool_allocator", steady, ops);
+    }
+}
+
+// Contiguous d-ary heaps against the tree engines on a random stream
+void benchHeap() {
+    const int n = 1000000;
+    vector<int> priorities = randomPriorities(n);
+
+    runFill<prq::red_black>("red_black random", priorities);
+    runFill<prq::dary_heap<2>>("dary_heap<2> random", priorities);
+    runFill<prq::dary_heap<4>>("dary_heap<4> random", priorities);
+    runFill<prq::dary_heap<8>>("dary_heap<8> random", priorities);
+    runFill<prq::dary_heap<4>>("dary_heap<4> ascending", ascendingPriorities(n));
+}
+
+// Payload that counts its copies and moves
+struct CountedPayload {
+    static long long copies;
+    static long long moves;
+
+    string text;
+
+    explicit CountedPayload(string text) : text(std::move(text)) {}
+    CountedPayload(const CountedPayload& other) : text(other.text) { copies++; }
+    CountedPayload(CountedPayload&& other) noexcept : text(std::move(other.text)) { moves++; }
+    CountedPayload& operator=(const CountedPayload& other) { text = other.text; copies++; return *this; }
+    CountedPayload& operator=(CountedPayload&& other) noexcept { text = std::move(other.text); moves++; return *this; }
+};
+
+long long CountedPayload::copies = 0;
+long long CountedPayload::moves = 0;
+
+// Copies and moves per element on the enqueue/emplace -> dequeue path
+template<typename Engine>
+void runPayload(const string& name, const vector<int>& priorities) {
+    prqueue<CountedPayload, int, less<int>, Engine> pq;
+    int n = int(priorities.size());
+    CountedPayload::copies = 0;
+    CountedPayload::moves = 0;
+
+    double seconds = timeIt([&] {
+        for (int i = 0; i < n; i += 2) {
+            pq.enqueue(CountedPayload("a payload long enough to live on the heap"), priorities[i]);
+            if (i + 1 < n) {
+                pq.emplace(priorities[i + 1], "a payload long enough to live on the heap");
+            }
+        }
+        while (pq.size() > 0) {
+            benchSink += pq.dequeue().text.size();
+        }
+    });
+    printRow(name + " enqueue+dequeue", n, seconds);
+    printf("  %-34s copies/elem %.2f  moves/elem %.2f\n", "",
+           double(CountedPayload::copies) / n, double(CountedPayload::moves) / n);
+}
+
+void benchPayload() {
+    const int n = 200000;
+    vector<int> priorities = randomPriorities(n);
+
+    runPayload<prq::bst>("bst", priorities);
+    runPayload<prq::red_black>("red_black", priorities);
+    runPayload<prq::dary_heap<4>>("dary_heap<4>", priorities);
+}
+
+// Warm start from a snapshot: range assign against an enqueue loop.
+// Runs in a child so earlier runs do not leave a scattered free list behind.
+template<typename Engine>
+void runStartup(const string& name, const vector<int>& priorities) {
+    inChild([&] {
+        int n = int(priorities.size());
+        vector<pair<int, int>> snapshot(n);
+        for (int i = 0; i < n; i++) {
+            snapshot[i] = {i, priorities[i]};
+        }
+
+        double looped = timeIt([&] {
+            prqueue<int, int, less<int>, Engine> pq;
+            for (auto& entry : snapshot) {
+                pq.enqueue(entry.first, entry.second);
+            }
+            benchSink += pq.size();
+        });
+        double built = timeIt([&] {
+            prqueue<int, int, less<int>, Engine> pq(snapshot.begin(), snapshot.end());
+            benchSink += pq.size();
+        });
+        printRow(name + " enqueue loop", n, looped);
+        printRow(name + " assign", n, built);
+    });
+}
+
+// Startup time including teardown; the plain BST enqueue loop is
+// quadratic on the ascending snapshot, so it gets a slice of it
+void benchStartup() {
+    const int n = 1000000;
+    const int slice = 20000;
+
+    runStartup<prq::bst>("bst random", randomPriorities(n));
+    runStartup<prq::bst>("bst ascending", ascendingPriorities(slice));
+    runStartup<prq::red_black>("red_black random", randomPriorities(n));
+    runStartup<prq::red_black>("red_black ascending", ascendingPriorities(n));
+    runStartup<prq::dary_heap<4>>("dary_heap<4> random", randomPriorities(n));
+}
+
+// Restart from disk: save() a queue of `priorities`, then rebuild it with
+// load() against replaying the same records through an enqueue loop. The
+// load and the replay run in children so neither reuses the other's free list.
+template<typename Engine>
+void runSnapshot(const string& name, const vector<int>& priorities) {
+    using Queue = prqueue<int, int, less<int>, Engine>;
+    const string path = "benchmarks.snapshot";
+    int n = int(priorities.size());
+    inChild([&] {
+        Queue pq;
+        for (int i = 0; i < n; i++) {
+            pq.enqueue(i, priorities[i]);
+        }
+        double saved = timeIt([&] {
+            pq.save(path);
+        });
+        printRow(name + " save", n, saved);
+    });
+
+    inChild([&] {
+        double replayed = timeIt([&] {
+            Queue pq;
+            for (int i = 0; i < n; i++) {
+                pq.enqueue(i, priorities[i]);
+            }
+            benchSink += pq.size();
+        });
+        printRow(name + " enqueue replay", n, replayed);
+    });
+
+    inChild([&] {
+        double loaded = timeIt([&] {
+            Queue pq;
+            pq.load(path);
+            benchSink += pq.size();
+        });
+        printRow(name + " load", n, loaded);
+    });
+    remove(path.c_str());
+}
+
+// Snapshot restore of 10^7 entries, teardown included
+void benchSnapshot() {
+    const int n = 10000000;
+    runSnapshot<prq::red_black>("red_black random", randomPriorities(n));
+    runSnapshot<prq::dary_heap<4>>("dary_heap<4> random", randomPriorities(n));
+    runSnapshot<prq::compact>("compact random", randomPriorities(n));
+}
+
+// Drain a full queue in batches of `batch`: dequeue() loop against dequeue_n
+template<typename Engine>
+void runDrain(const string& name, const vector<int>& priorities, int batch) {
+    int n = int(priorities.size());
+    vector<int> out;
+    out.reserve(batch);
+
+    prqueue<int, int, less<int>, Engine> looped;
+    prqueue<int, int, less<int>, Engine> batched;
+    for (int i = 0; i < n; i++) {
+        looped.enqueue(i, priorities[i]);
+        batched.enqueue(i, priorities[i]);
+    }
+
+    double loopSeconds = timeIt([&] {
+        while (looped.size() > 0) {
+            out.clear();
+            for (int i = 0; i < batch && looped.size() > 0; i++) {
+                out.push_back(looped.dequeue());
+            }
+            benchSink += out.size();
+        }
+    });
+    double batchSeconds = timeIt([&] {
+        while (batched.size() > 0) {
+            out.clear();
+            batched.dequeue_n(batch, back_inserter(out));
+            benchSink += out.size();
+        }
+    });
+    printRow(name + " dequeue loop", n, loopSeconds);
+    printRow(name + " dequeue_n", n, batchSeconds);
+}
+
+// Batched drain in batches of 1000, on distinct and heavily duplicated
+// priorities
+void benchDrain() {
+    const int n = 1000000;
+    vector<int> fewDistinct = randomPriorities(n);
+    for (int& priority : fewDistinct) {
+        priority %= 8;
+    }
+
+    runDrain<prq::bst>("bst random", randomPriorities(n), 1000);
+    runDrain<prq::red_black>("red_black random", randomPriorities(n), 1000);
+    runDrain<prq::red_black>("red_black 8 priorities", fewDistinct, 1000);
+    runDrain<prq::dary_heap<4>>("dary_heap<4> random", randomPriorities(n), 1000);
+}
+
+// Run `perThread(threadIndex)` on `threads` threads and time the whole batch
+template<typename F>
+double timeThreads(int threads, F perThread) {
+    return timeIt([&] {
+        vector<thread> pool;
+        for (int t = 0; t < threads; t++) {
+            pool.emplace_back(perThread, t);
+        }
+        for (thread& worker : pool) {
+            worker.join();
+        }
+    });
+}
+
+// Threads alternating enqueue and dequeue on a queue prefilled to 10^5:
+// concurrent_prqueue against one prqueue behind a global mutex
+void benchConcurrent() {
+    const int prefill = 100000;
+    const int opsPerThread = 200000;
+    int maxThreads = int(max(4u, thread::hardware_concurrency()));
+
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        long long ops = 2LL * opsPerThread * threads;
+
+        prqueue<int, int, less<int>, prq::dary_heap<4>> locked;
+        mutex globalLock;
+        for (int i = 0; i < prefill; i++) {
+            locked.enqueue(i, i * 7919 % prefill);
+        }
+        double lockedSeconds = timeThreads(threads, [&](int t) {
+            unsigned priority = unsigned(t) * 2654435761u;
+            for (int i = 0; i < opsPerThread; i++) {
+                priority = priority * 1103515245u + 12345u;
+                lock_guard<mutex> guard(globalLock);
+                locked.enqueue(i, int(priority % prefill));
+                benchSink += locked.dequeue();
+            }
+        });
+
+        concurrent_prqueue<int> shared;
+        for (int i = 0; i < prefill; i++) {
+            shared.enqueue(i, i * 7919 % prefill);
+        }
+        double sharedSeconds = timeThreads(threads, [&](int t) {
+            unsigned priority = unsigned(t) * 2654435761u;
+            int value;
+            for (int i = 0; i < opsPerThread; i++) {
+                priority = priority * 1103515245u + 12345u;
+                shared.enqueue(i, int(priority % prefill));
+                if (shared.try_dequeue(value)) {
+                    benchSink += value;
+                }
+            }
+        });
+
+        printf("  threads=%-3d global mutex %8.2f Mops/s   concurrent_prqueue %8.2f Mops/s\n",
+               threads, ops / lockedSeconds / 1e6, ops / sharedSeconds / 1e6);
+    }
+}
+
+// Full in-order walk: begin()/next() cursor against iterators
+template<typename Engine>
+void runIterate(const string& name, const vector<int>& priorities) {
+    int n = int(priorities.size());
+    prqueue<string, int, less<int>, Engine> pq;
+    for (int i = 0; i < n; i++) {
+        pq.enqueue("payload number " + to_string(i), priorities[i]);
+    }
+
+    double cursorSeconds = timeIt([&] {
+        string value;
+        int priority = 0;
+        pq.begin();
+        bool more = n > 0;
+        while (more) {
+            more = pq.next(value, priority);
+            benchSink += priority + value.size();
+        }
+    });
+    double rangeSeconds = timeIt([&] {
+        const auto& view = pq;
+        for (const auto& element : view) {
+            benchSink += element.priority + element.value.size();
+        }
+    });
+    double accumulateSeconds = timeIt([&] {
+        benchSink += accumulate(pq.cbegin(), pq.cend(), size_t(0),
+                                [](size_t sum, const auto& element) { return sum + element.value.size(); });
+    });
+    printRow(name + " next() loop", n, cursorSeconds);
+    printRow(name + " range-for", n, rangeSeconds);
+    printRow(name + " std::accumulate", n, accumulateSeconds);
+}
+
+void benchIterate() {
+    const int n = 1000000;
+    vector<int> fewDistinct = randomPriorities(n);
+    for (int& priority : fewDistinct) {
+        priority %= 8;
+    }
+
+    runIterate<prq::bst>("bst random", randomPriorities(n));
+    runIterate<prq::red_black>("red_black random", randomPriorities(n));
+    runIterate<prq::red_black>("red_black 8 priorities", fewDistinct);
+}
+
+// Random directed graph as adjacency lists of (target, weight)
+vector<vector<pair<int, int>>> randomGraph(int vertices, int edges) {
+    mt19937 rng(99);
+    vector<vector<pair<int, int>>> graph(vertices);
+    for (int v = 0; v + 1 < vertices; v++) {
+        graph[v].push_back({v + 1, int(rng() % 1000) + 1});  // Keep everything reachable
+    }
+    for (int e = vertices - 1; e < edges; e++) {
+        graph[rng() % vertices].push_back({int(rng() % vertices), int(rng() % 1000) + 1});
+    }
+    return graph;
+}
+
+// Dijkstra with decrease-key through handles
+template<typename Engine>
+vector<int> dijkstraDecreaseKey(const vector<vector<pair<int, int>>>& graph) {
+    using Queue = prqueue<int, int, less<int>, Engine>;
+    vector<int> dist(graph.size(), INT_MAX);
+    vector<typename Queue::handle> handles(graph.size());
+    vector<bool> queued(graph.size(), false);
+    Queue pq;
+
+    dist[0] = 0;
+    handles[0] = pq.enqueue(0, 0);
+    queued[0] = true;
+    while (pq.size() > 0) {
+        int v = pq.dequeue();
+        queued[v] = false;
+        for (auto [target, weight] : graph[v]) {
+            int candidate = dist[v] + weight;
+            if (candidate < dist[target]) {
+                dist[target] = candidate;
+                if (queued[target]) {
+                    pq.update_priority(handles[target], candidate);
+                } else {
+                    handles[target] = pq.enqueue(target, candidate);
+                    queued[target] = true;
+                }
+            }
+        }
+    }
+    return dist;
+}
+
+// Dijkstra without decrease-key: enqueue again and skip stale entries
+template<typename Engine>
+vector<int> dijkstraLazy(const vector<vector<pair<int, int>>>& graph) {
+    vector<int> dist(graph.size(), INT_MAX);
+    prqueue<int, int, less<int>, Engine> pq;
+
+    dist[0] = 0;
+    pq.enqueue(0, 0);
+    while (pq.size() > 0) {
+        int priority = pq.peekPriority();
+        int v = pq.dequeue();
+        if (priority > dist[v]) {
+            continue;  // Stale entry
+        }
+        for (auto [target, weight] : graph[v]) {
+            int candidate = dist[v] + weight;
+            if (candidate < dist[target]) {
+                dist[target] = candidate;
+                pq.enqueue(target, candidate);
+            }
+        }
+    }
+    return dist;
+}
+
+// Shortest paths on a 2*10^5 vertex, 10^6 edge random graph
+void benchDijkstra() {
+    const int vertices = 200000;
+    const int edges = 1000000;
+    auto graph = randomGraph(vertices, edges);
+    vector<int> expected;
+
+    double lazySeconds = timeIt([&] { expected = dijkstraLazy<prq::dary_heap<4>>(graph); });
+    printRow("dary_heap<4> lazy deletion", edges, lazySeconds);
+
+    vector<int> dist;
+    double redBlackSeconds = timeIt([&] { dist = dijkstraDecreaseKey<prq::red_black>(graph); });
+    printRow("red_black decrease-key", edges, redBlackSeconds);
+    if (dist != expected) {
+        printf("  red_black distances differ!\n");
+    }
+
+    double bstSeconds = timeIt([&] { dist = dijkstraDecreaseKey<prq::bst>(graph); });
+    printRow("bst decrease-key", edges, bstSeconds);
+    if (dist != expected) {
+        printf("  bst distances differ!\n");
+    }
+}
+
+// Fill and drain a queue keyed by `Priority` under `Compare`, with the
+// random stream converted to that type
+template<typename Priority, typename Compare, typename Engine>
+void runPriorityType(const string& name, const vector<int>& priorities) {
+    int n = int(priorities.size());
+    vector<Priority> keys(n);
+    for (int i = 0; i < n; i++) {
+        keys[i] = Priority(priorities[i]);
+    }
+
+    prqueue<int, Priority, Compare, Engine> pq;
+    double seconds = timeIt([&] {
+        for (int i = 0; i < n; i++) {
+            pq.enqueue(i, keys[i]);
+        }
+        while (pq.size() > 0) {
+            benchSink += pq.dequeue();
+        }
+    });
+    printRow(name, n, seconds);
+}
+
+// int, long long and double priorities, and a max-first comparator, through
+// the same enqueue/dequeue cycle; the int row is the baseline
+void benchPriorities() {
+    const int n = 1000000;
+    vector<int> priorities = randomPriorities(n);
+
+    runPriorityType<int, less<int>, prq::red_black>("red_black int", priorities);
+    runPriorityType<long long, less<long long>, prq::red_black>("red_black long long", priorities);
+    runPriorityType<double, less<double>, prq::red_black>("red_black double", priorities);
+    runPriorityType<int, greater<int>, prq::red_black>("red_black int greater", priorities);
+    runPriorityType<int, less<int>, prq::dary_heap<4>>("dary_heap<4> int", priorities);
+    runPriorityType<long long, less<long long>, prq::dary_heap<4>>("dary_heap<4> long long", priorities);
+    runPriorityType<double, less<double>, prq::dary_heap<4>>("dary_heap<4> double", priorities);
+}
+
+// Fill with `priorities`, then run `n` hold operations (dequeue the minimum,
+// enqueue at a priority up to 63 levels behind it), then drain
+template<typename Engine>
+void runBucketLoad(const string& name, const vector<int>& priorities) {
+    int n = int(priorities.size());
+    prqueue<int, int, less<int>, Engine> pq;
+
+    double fillSeconds = timeIt([&] {
+        for (int i = 0; i < n; i++) {
+            pq.enqueue(i, priorities[i]);
+        }
+    });
+    double holdSeconds = timeIt([&] {
+        for (int i = 0; i < n; i++) {
+            int priority = pq.peekPriority();
+            benchSink += pq.dequeue();
+            pq.enqueue(i, min(priority + priorities[i] % 64, 4095));
+        }
+    });
+    double drainSeconds = timeIt([&] {
+        while (pq.size() > 0) {
+            benchSink += pq.dequeue();
+        }
+    });
+    printRow(name + " enqueue", n, fillSeconds);
+    printRow(name + " hold", n, holdSeconds);
+    printRow(name + " dequeue", n, drainSeconds);
+}
+
+// Integer priorities in 0..4095: the bucket engine against the comparison engines
+void benchBuckets() {
+    const int n = 1000000;
+    vector<int> priorities = randomPriorities(n);
+    for (int& priority : priorities) {
+        priority %= 4096;
+    }
+
+    runBucketLoad<prq::buckets<4096>>("buckets<4096>", priorities);
+    runBucketLoad<prq::dary_heap<4>>("dary_heap<4>", priorities);
+    runBucketLoad<prq::red_black>("red_black", priorities);
+    runBucketLoad<prq::bst>("bst", priorities);
+}
+
+// 256-byte payload for the layout benchmark
+struct Blob256 {
+    long long id;
+    char bytes[248];
+
+    explicit Blob256(long long id = 0) : id(id) {
+        memset(bytes, 0, sizeof(bytes));
+    }
+};
+
+// Fill and drain with `makeValue(i)` payloads, counting cache misses per phase
+template<typename T, typename Engine, typename Make>
+void runLayout(const string& name, const vector<int>& priorities, Make makeValue) {
+    int n = int(priorities.size());
+    prqueue<T, int, less<int>, Engine> pq;
+    PerfCounter misses(PERF_COUNT_HW_CACHE_MISSES);
+
+    misses.start();
+    double fillSeconds = timeIt([&] {
+        for (int i = 0; i < n; i++) {
+            pq.enqueue(makeValue(i), priorities[i]);
+        }
+    });
+    long long fillMisses = misses.stop();
+
+    misses.start();
+    double drainSeconds = timeIt([&] {
+        while (pq.size() > 0) {
+            T value = pq.dequeue();
+            benchSink += sizeof(value);
+        }
+    });
+    long long drainMisses = misses.stop();
+
+    printMissRow(name + " enqueue", n, fillSeconds, fillMisses);
+    printMissRow(name + " dequeue", n, drainSeconds, drainMisses);
+}
+
+// Pointer-linked red-black NODEs against the compact engine's split
+// key/payload arrays, for string and 256-byte payloads
+void benchLayout() {
+    const int n = 1000000;
+    vector<int> priorities = randomPriorities(n);
+    auto makeString = [](int i) { return to_string(i); };
+    auto makeBlob = [](int i) { return Blob256(i); };
+
+    runLayout<string, prq::red_black>("red_black string", priorities, makeString);
+    runLayout<string, prq::compact>("compact string", priorities, makeString);
+    runLayout<Blob256, prq::red_black>("red_black 256-byte", priorities, makeBlob);
+    runLayout<Blob256, prq::compact>("compact 256-byte", priorities, makeBlob);
+}
+
+// Move `count` queues of `size` elements into a vector one push_back at a
+// time, then rotate them. Each reallocation moves the queues; the deep-copy
+// row is what a single reallocation cost before queues were movable.
+template<typename Engine>
+void runEpochs(const string& name, int count, int size) {
+    using Queue = prqueue<int, int, less<int>, Engine>;
+    vector<int> priorities = randomPriorities(size);
+    Queue source;
+    for (int i = 0; i < size; i++) {
+        source.enqueue(i, priorities[i]);
+    }
+
+    vector<Queue> pending(count, source);
+    vector<Queue> epochs;
+    double growSeconds = timeIt([&] {
+        for (Queue& queue : pending) {
+            epochs.push_back(std::move(queue));
+        }
+    });
+    double copySeconds = timeIt([&] {
+        vector<Queue> copies(epochs);
+        benchSink += copies.size();
+    });
+    double rotateSeconds = timeIt([&] {
+        for (int round = 0; round < 1000; round++) {
+            for (int i = 1; i < count; i++) {
+                swap(epochs[i - 1], epochs[i]);
+            }
+        }
+    });
+    printRow(name + " grow by push_back", count, growSeconds);
+    printRow(name + " deep copy of all", count, copySeconds);
+    printRow(name + " rotate by swap", count * 1000, rotateSeconds);
+}
+
+// A vector of 1000 queues of 1000 elements
+void benchEpochs() {
+    runEpochs<prq::bst>("bst", 1000, 1000);
+    runEpochs<prq::red_black>("red_black", 1000, 1000);
+    runEpochs<prq::dary_heap<4>>("dary_heap<4>", 1000, 1000);
+    runEpochs<prq::compact>("compact", 1000, 1000);
+}
+
+// Move a queue of `theirs` random priorities below `levels` into one of
+// `mine`, once by dequeue/enqueue and once with merge(). With `disjoint`,
+// priorities count up instead so every one of theirs comes after ours.
+template<typename Engine>
+void runMerge(const string& name, int mine, int theirs, int levels = INT_MAX, bool disjoint = false) {
+    using Queue = prqueue<int, int, less<int>, Engine>;
+    vector<int> priorities = randomPriorities(mine + theirs);
+    if (disjoint) {
+        iota(priorities.begin(), priorities.end(), 0);
+    }
+    auto fill = [&](Queue& pq, int from, int to) {
+        for (int i = from; i < to; i++) {
+            pq.enqueue(i, priorities[i] % levels);
+        }
+    };
+
+    Queue looped, loopedOther;
+    fill(looped, 0, mine);
+    fill(loopedOther, mine, mine + theirs);
+    double loopSeconds = timeIt([&] {
+        while (loopedOther.size() > 0) {
+            int priority = loopedOther.peekPriority();
+            looped.enqueue(loopedOther.dequeue(), priority);
+        }
+    });
+
+    Queue merged, mergedOther;
+    fill(merged, 0, mine);
+    fill(mergedOther, mine, mine + theirs);
+    double mergeSeconds = timeIt([&] {
+        merged.merge(std::move(mergedOther));
+    });
+    benchSink += merged.size();
+
+    string sizes = " " + to_string(theirs) + " into " + to_string(mine) + (disjoint ? " disjoint" : "");
+    printRow(name + sizes + " loop", theirs, loopSeconds);
+    printRow(name + sizes + " merge", theirs, mergeSeconds);
+}
+
+// Merging queues of 10^6 elements, a small queue into a large one, and
+// queues whose priority ranges do not overlap
+void benchMerge() {
+    const int n = 1000000;
+    runMerge<prq::red_black>("red_black", n, n);
+    runMerge<prq::red_black>("red_black", n, 1000);
+    runMerge<prq::red_black>("red_black", n, n, INT_MAX, true);
+    runMerge<prq::bst>("bst", n, n);
+    runMerge<prq::dary_heap<4>>("dary_heap<4>", n, n);
+    runMerge<prq::dary_heap<4>>("dary_heap<4>", n, 1000);
+    runMerge<prq::buckets<4096>>("buckets<4096>", n, n, 4096);
+    runMerge<prq::compact>("compact", n, n);
+}
+
+// Cut a queue of `n` random priorities below `levels` at its median: split()
+// against dequeue/enqueue into a second queue, then take out a tenth of the
+// range with extract_range() against a begin()/next() scan that re-enqueues
+// the survivors into a fresh queue
+template<typename Engine>
+void runSplit(const string& name, int n, int levels = INT_MAX) {
+    using Queue = prqueue<int, int, less<int>, Engine>;
+    vector<int> priorities = randomPriorities(n);
+    for (int& priority : priorities) {
+        priority %= levels;
+    }
+    vector<int> sorted(priorities);
+    sort(sorted.begin(), sorted.end());
+    int median = sorted[n / 2];
+    int hi = sorted[n / 2 + n / 10];
+    auto fill = [&](Queue& pq) {
+        for (int i = 0; i < n; i++) {
+            pq.enqueue(i, priorities[i]);
+        }
+    };
+
+    Queue looped, loopedLower;
+    fill(looped);
+    double loopSeconds = timeIt([&] {
+        while (looped.size() > 0 && looped.peekPriority() < median) {
+            int priority = looped.peekPriority();
+            loopedLower.enqueue(looped.dequeue(), priority);
+        }
+    });
+    benchSink += loopedLower.size();
+
+    Queue splitted, splitLower;
+    fill(splitted);
+    double splitSeconds = timeIt([&] {
+        splitLower = splitted.split(median);
+    });
+    benchSink += splitLower.size();
+
+    Queue scanned;
+    fill(scanned);
+    vector<int> taken;
+    taken.reserve(n);
+    double scanSeconds = timeIt([&] {
+        Queue survivors;
+        int value;
+        int priority;
+        scanned.begin();
+        while (scanned.next(value, priority)) {
+            if (priority >= median && priority < hi) {
+                taken.push_back(value);
+            } else {
+                survivors.enqueue(value, priority);
+            }
+        }
+        scanned = std::move(survivors);
+    });
+    benchSink += int(taken.size());
+
+    Queue extracted;
+    fill(extracted);
+    taken.clear();
+    double extractSeconds = timeIt([&] {
+        extracted.extract_range(median, hi, back_inserter(taken));
+    });
+    benchSink += int(taken.size());
+
+    printRow(name + " split loop", n / 2, loopSeconds);
+    printRow(name + " split", n / 2, splitSeconds);
+    printRow(name + " range scan", n / 10, scanSeconds);
+    printRow(name + " extract_range", n / 10, extractSeconds);
+}
+
+// Splitting and range extraction on 10^6 elements. The bst engine is left
+// out: the scan re-enqueues survivors in sorted order, a degenerate tree.
+void benchSplit() {
+    const int n = 1000000;
+    runSplit<prq::red_black>("red_black", n);
+    runSplit<prq::dary_heap<4>>("dary_heap<4>", n);
+    runSplit<prq::buckets<4096>>("buckets<4096>", n, 4096);
+    runSplit<prq::compact>("compact", n);
+}
+
+// Answer `queries` "how many are ahead of priority p" questions on a queue
+// of `n` random priorities below `levels`: rank() against walking the queue
+// with next()
+template<typename Engine>
+void runRank(const string& name, int n, int queries, int levels = INT_MAX) {
+    using Queue = prqueue<int, int, less<int>, Engine>;
+    vector<int> priorities = randomPriorities(n);
+    for (int& priority : priorities) {
+        priority %= levels;
+    }
+    Queue pq;
+    double fillSeconds = timeIt([&] {
+        for (int i = 0; i < n; i++) {
+            pq.enqueue(i, priorities[i]);
+        }
+    });
+
+    double rankSeconds = timeIt([&] {
+        for (int q = 0; q < queries; q++) {
+            benchSink += pq.rank(priorities[q]) + pq.count(priorities[q]);
+        }
+    });
+
+    int walks = min(queries, 10);
+    double walkSeconds = timeIt([&] {
+        for (int q = 0; q < walks; q++) {
+            int ahead = 0;
+            int value;
+            int priority;
+            pq.begin();
+            while (pq.next(value, priority) && priority <= priorities[q]) {
+                ahead++;
+            }
+            benchSink += ahead;
+        }
+    });
+
+    double drainSeconds = timeIt([&] {
+        while (pq.size() > 0) {
+            benchSink += pq.dequeue();
+        }
+    });
+
+    printRow(name + " fill", n, fillSeconds);
+    printRow(name + " rank + count", queries, rankSeconds);
+    printRow(name + " next() walk", walks, walkSeconds);
+    printRow(name + " drain", n, drainSeconds);
+}
+
+// Rank queries on 10^6 elements, and what keeping the counts costs
+void benchRank() {
+    const int n = 1000000;
+    runRank<prq::red_black>("red_black", n, 10);
+    runRank<prq::ranked>("ranked", n, 100000);
+    runRank<prq::compact>("compact", n, 10);
+    runRank<prq::buckets<4096>>("buckets<4096>", n, 100000, 4096);
+}
+
+// Dump a queue of `n` random priorities as text: the old ostringstream and
+// endl formatting (rebuilt here with next()), toString(), and write_to()
+// streaming into /dev/null
+template<typename T, typename Engine, typename Make>
+void runDump(const string& name, int n, Make makeValue) {
+    using Queue = prqueue<T, int, less<int>, Engine>;
+    vector<int> priorities = randomPriorities(n);
+    Queue pq;
+    for (int i = 0; i < n; i++) {
+        pq.enqueue(makeValue(i), priorities[i]);
+    }
+
+    double streamSeconds = timeIt([&] {
+        ostringstream oss;
+        T value{};
+        int priority = 0;
+        pq.begin();
+        for (bool more = pq.size() > 0; more; ) {
+            more = pq.next(value, priority);
+            oss << priority << " value: " << value << endl;
+        }
+        benchSink += oss.str().size();
+    });
+
+    double stringSeconds = timeIt([&] {
+        benchSink += pq.toString().size();
+    });
+
+    ofstream devnull("/dev/null");
+    double writeSeconds = timeIt([&] {
+        pq.write_to(devnull);
+    });
+
+    printRow(name + " ostream + endl", n, streamSeconds);
+    printRow(name + " toString", n, stringSeconds);
+    printRow(name + " write_to", n, writeSeconds);
+}
+
+// Diagnostic dumps of 10^6 elements
+void benchDump() {
+    const int n = 1000000;
+    runDump<int, prq::red_black>("red_black int", n, [](int i) { return i; });
+    runDump<string, prq::red_black>("red_black string", n, [](int i) { return "job-" + to_string(i); });
+    runDump<int, prq::dary_heap<4>>("dary_heap<4> int", n, [](int i) { return i; });
+    runDump<int, prq::compact>("compact int", n, [](int i) { return i; });
+}
+
+// Enqueue, next() walk and dequeue of `priorities` on a tree engine. Build
+// once as is and once with -DPRQUEUE_STATS=1: the plain build must time
+// the same as before the counters existed, the counting one also prints
+// what it saw.
+template<typename Engine>
+void runStats(const string& name, const vector<int>& priorities) {
+    int n = int(priorities.size());
+    prqueue<int, int, less<int>, Engine> pq;
+    double fillSeconds = timeIt([&] {
+        for (int i = 0; i < n; i++) {
+            pq.enqueue(i, priorities[i]);
+        }
+    });
+    double walkSeconds = timeIt([&] {
+        int value;
+        int priority;
+        pq.begin();
+        while (pq.next(value, priority)) {
+            benchSink += value;
+        }
+    });
+#if PRQUEUE_STATS
+    int height = pq.stats().height;
+#endif
+    double drainSeconds = timeIt([&] {
+        while (pq.size() > 0) {
+            benchSink += pq.dequeue();
+        }
+    });
+    printRow(name + " enqueue", n, fillSeconds);
+    printRow(name + " next()", n, walkSeconds);
+    printRow(name + " dequeue", n, drainSeconds);
+#if PRQUEUE_STATS
+    prq::queue_stats stats = pq.stats();
+    printf("  %-34s height %d, visits per enqueue %.1f, next() %.1f, dequeue %.1f\n", name.c_str(),
+           height, double(stats.enqueueVisits) / stats.enqueues,
+           double(stats.nextVisits) / stats.nexts, double(stats.dequeueVisits) / stats.dequeues);
+#endif
+}
+
+// Cost of the PRQUEUE_STATS counters on 10^6 elements
+void benchStats() {
+#if PRQUEUE_STATS
+    printf("  counters compiled in, sizeof(prqueue<int>) = %zu\n", sizeof(prqueue<int>));
+#else
+    printf("  counters compiled out, sizeof(prqueue<int>) = %zu\n", sizeof(prqueue<int>));
+#endif
+    const int n = 1000000;
+    runStats<prq::bst>("bst random", randomPriorities(n));
+    runStats<prq::red_black>("red_black random", randomPriorities(n));
+    runStats<prq::red_black>("red_black ascending", ascendingPriorities(n));
+}
+
+// Enqueue, next() walk and FIFO drain of `priorities`, which repeat so
+// that every enqueue lands at the end of a long duplicate chain
+template<typename Engine>
+void runChains(const string& name, const vector<int>& priorities) {
+    int n = int(priorities.size());
+    prqueue<int, int, less<int>, Engine> pq;
+    double fillSeconds = timeIt([&] {
+        for (int i = 0; i < n; i++) {
+            pq.enqueue(i, priorities[i]);
+        }
+    });
+    double walkSeconds = timeIt([&] {
+        int value;
+        int priority;
+        pq.begin();
+        while (pq.next(value, priority)) {
+            benchSink += value;
+        }
+    });
+    double drainSeconds = timeIt([&] {
+        while (pq.size() > 0) {
+            benchSink += pq.dequeue();
+        }
+    });
+    printRow(name + " enqueue", n, fillSeconds);
+    printRow(name + " next()", n, walkSeconds);
+    printRow(name + " dequeue", n, drainSeconds);
+}
+
+// 10^6 elements across 8 distinct priorities: chains of ~125000 that used
+// to be walked in full on every enqueue
+void benchChains() {
+    const int n = 1000000;
+    mt19937 rng(8);
+    vector<int> priorities(n);
+    for (int i = 0; i < n; i++) {
+        priorities[i] = int(rng() % 8);
+    }
+    runChains<prq::bst>("bst 8 priorities", priorities);
+    runChains<prq::red_black>("red_black 8 priorities", priorities);
+    runChains<prq::ranked>("ranked 8 priorities", priorities);
+    runChains<prq::compact>("compact 8 priorities", priorities);
+    runChains<prq::dary_heap<4>>("dary_heap<4> 8 priorities", priorities);
+}
+
+// Repeated == on two queues of n elements each: equal contents held in
+// differently shaped trees, which are walked to the end, and contents that
+// differ only in the last value, which the content hash rejects up front
+template<typename Engine, typename T, typename MakeValue>
+void runEquality(const string& name, int n, MakeValue makeValue) {
+    using Queue = prqueue<T, int, less<int>, Engine>;
+    vector<int> priorities = randomPriorities(n);
+    vector<pair<T, int>> entries;
+    for (int i = 0; i < n; i++) {
+        entries.emplace_back(makeValue(i), priorities[i]);
+    }
+    Queue grown;
+    double fillSeconds = timeIt([&] {
+        for (const auto& entry : entries) {
+            grown.enqueue(entry.first, entry.second);
+        }
+    });
+    Queue built(entries.begin(), entries.end());
+    auto last = max_element(entries.begin(), entries.end(),
+                            [](const auto& a, const auto& b) { return a.second < b.second; });
+    last->first = makeValue(-1);
+    Queue changed(entries.begin(), entries.end());
+
+    const int rounds = 20;
+    int equal = 0;
+    double sameSeconds = timeIt([&] {
+        for (int r = 0; r < rounds; r++) {
+            equal += grown == built;
+        }
+    });
+    double changedSeconds = timeIt([&] {
+        for (int r = 0; r < rounds; r++) {
+            equal += grown == changed;
+        }
+    });
+    benchSink += equal;
+    printRow(name + " enqueue", n, fillSeconds);
+    printRow(name + " == equal", rounds, sameSeconds);
+    printRow(name + " == last value differs", rounds, changedSeconds);
+    if (equal != rounds) {
+        printf("  %s: %d comparisons equal, expected %d\n", name.c_str(), equal, rounds);
+    }
+}
+
+// Content equality against the tree shape, 10^6 elements
+void benchEquality() {
+    const int n = 1000000;
+    runEquality<prq::red_black, int>("red_black int", n, [](int i) { return i; });
+    runEquality<prq::bst, int>("bst int", n, [](int i) { return i; });
+    runEquality<prq::red_black, string>("red_black string", n, [](int i) { return "value " + to_string(i); });
+    runEquality<prq::compact, int>("compact int", n, [](int i) { return i; });
+}
+
+// Owner throughput while a monitor takes copies: n queued elements, one
+// enqueue and one dequeue per step, and a copy of the queue every `every`
+// steps that is held until the next one (0 = never copied). Deep copies
+// that would take minutes are left out.
+template<typename Engine>
+void runCopies(const string& name, int n, int every) {
+    const int steps = 200000;
+    string label = name + (every ? " copy every " + to_string(every) : " never copied");
+    bool deepCopies = !is_same_v<Engine, prq::persistent>;
+    if (deepCopies && every && double(steps) / every * n > 2e8) {
+        printf("  %-34s skipped, %d deep copies of %d elements\n", label.c_str(), steps / every, n);
+        return;
+    }
+    vector<int> priorities = randomPriorities(n + steps);
+    prqueue<int, int, less<int>, Engine> live;
+    for (int i = 0; i < n; i++) {
+        live.enqueue(i, priorities[i]);
+    }
+    prqueue<int, int, less<int>, Engine> held;
+    double seconds = timeIt([&] {
+        for (int i = 0; i < steps; i++) {
+            if (every && i % every == 0) {
+                held = live;
+            }
+            live.enqueue(n + i, priorities[n + i]);
+            benchSink += live.dequeue();
+        }
+    });
+    benchSink += held.size();
+    printRow(label, steps, seconds);
+}
+
+// Copy-on-write against deep copies, 10^5 queued elements
+void benchCopies() {
+    const int n = 100000;
+    for (int every : {0, 100000, 10000, 1000, 100, 10, 1}) {
+        runCopies<prq::red_black>("red_black", n, every);
+    }
+    for (int every : {0, 100000, 10000, 1000, 100, 10, 1}) {
+        runCopies<prq::persistent>("persistent", n, every);
+    }
+}
+
+struct Benchmark {
+    const char* name;
+    void (*run)();
+};
+
+const Benchmark benchmarks[] = {
+    {"balance", benchBalance},
+    {"minimum", benchMinimum},
+    {"churn", benchChurn},
+    {"heap", benchHeap},
+    {"payload", benchPayload},
+    {"startup", benchStartup},
+    {"snapshot", benchSnapshot},
+    {"drain", benchDrain},
+    {"concurrent", benchConcurrent},
+    {"iterate", benchIterate},
+    {"dijkstra", benchDijkstra},
+    {"priorities", benchPriorities},
+    {"buckets", benchBuckets},
+    {"layout", benchLayout},
+    {"epochs", benchEpochs},
+    {"merge", benchMerge},
+    {"split", benchSplit},
+    {"rank", benchRank},
+    {"dump", benchDump},
+    {"stats", benchStats},
+    {"chains", benchChains},
+    {"equality", benchEquality},
+    {"copies", benchCopies},
+};
+
+int main(int argc, char* argv[]) {
+    for (const Benchmark& bench : benchmarks) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++) {
+            selected = selected || strcmp(argv[i], bench.name) == 0;
+        }
+        if (selected) {
+            printf("%s\n", bench.name);
+            bench.run();
+        }
+    }
+    return 0;
+}
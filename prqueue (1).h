@@ -4,6 +4,29 @@
 /// Description: This file creates a custom binary search
 /// that creates a priority queue based on priority values
 /// and updates the queue of people based on lowest priority.
+///
+/// Priorities are ints compared with < unless the second and third
+/// template parameters name another Priority type and Compare function
+/// (e.g. long long timestamps, double scores or std::greater for max-first).
+///
+/// The tree engine is chosen with the fourth template parameter:
+/// prq::bst (default) is the plain binary search tree, and
+/// prq::red_black keeps the same tree red-black balanced so that
+/// enqueue and dequeue stay O(log n) even on sorted input.
+/// prq::ranked is red_black plus a count of the elements under every node,
+/// so rank() and count() are O(log n) at the cost of O(log n) dequeues.
+/// prq::dary_heap<D> swaps the tree for a contiguous D-ary heap with
+/// the same public functions, for queues that are only filled and drained.
+/// prq::buckets<L> keeps one FIFO per integer priority in [0, L) with a
+/// bitmap of the non-empty levels, for small bounded priority ranges.
+/// prq::compact is the red-black tree with the priorities and 32-bit links
+/// in one array and the values in another, so descents skip the payloads.
+/// prq::persistent shares its NODEs between copies: copying a queue is
+/// O(1) and each later change clones only the NODEs on its O(log n) path.
+/// concurrent_prqueue at the end of the file shares one queue between threads.
+///
+/// NODEs are allocated through the fifth template parameter, which
+/// defaults to prq::pool_allocator, a slab allocator with a free list.
 
 
 #pragma once
@@ -11,439 +34,5196 @@
 #include <iostream>
 #include <sstream>
 #include <set>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PRQ_HAVE_MMAP 1
+#endif
+
+// Define PRQUEUE_STATS to 1 before including this header to have the tree
+// engines count their work, see prqueue::stats(). When it is 0 (the default)
+// the counting code and the counters themselves are compiled out.
+#ifndef PRQUEUE_STATS
+#define PRQUEUE_STATS 0
+#endif
+#if PRQUEUE_STATS
+#define PRQ_STAT(...) __VA_ARGS__
+#else
+#define PRQ_STAT(...)
+#endif
 
 using namespace std;
 
-template<typename T>
+namespace prq {
+    // Engine tags selecting how prqueue stores its elements
+    struct bst {
+        static constexpr bool balanced = false;  // Plain BST, shape follows arrival order
+        static constexpr bool counted = false;   // No subtree counts
+    };
+    struct red_black {
+        static constexpr bool balanced = true;   // Red-black balanced BST
+        static constexpr bool counted = false;
+    };
+    struct ranked {
+        static constexpr bool balanced = true;   // Red-black balanced BST ...
+        static constexpr bool counted = true;    // ... that counts the elements under every node
+    };
+    template<unsigned D>
+    struct dary_heap {
+        static_assert(D >= 2, "a heap node needs at least two children");
+        static constexpr unsigned arity = D;     // Children per heap slot
+    };
+    struct compact {
+        static constexpr bool balanced = true;   // Red-black tree over an index array
+    };
+    template<unsigned L>
+    struct buckets {
+        static_assert(L >= 1, "a bucket queue needs at least one level");
+        static constexpr unsigned levels = L;    // Integer priorities 0 .. L-1
+    };
+    struct persistent {
+        static constexpr bool balanced = true;   // Treap over NODEs shared between copies
+    };
+
+    // Fixed-size block pool shared by every pool_allocator with the same
+    // block size. Blocks are carved out of large slabs and recycled through
+    // a free list; slabs are kept for the lifetime of the process, so a
+    // block can be freed from any thread or queue.
+    template<size_t Size, size_t Align>
+    class slab_pool {
+    public:
+        // The pool is never destroyed, so queues with static storage
+        // duration can still free their nodes during shutdown
+        static slab_pool& instance() {
+            static slab_pool* pool = new slab_pool();
+            return *pool;
+        }
+
+        void* allocate() {
+            lock();
+            Block* block = freeList;
+            if (block) {
+                freeList = block->next;
+            } else {
+                if (cursor == end) {
+                    grow();
+                }
+                block = cursor++;
+            }
+            unlock();
+            return block;
+        }
+
+        void deallocate(void* p) {
+            Block* block = static_cast<Block*>(p);
+            lock();
+            block->next = freeList;
+            freeList = block;
+            unlock();
+        }
+
+    private:
+        union Block {
+            Block* next;  // Next free block while on the free list
+            alignas(Align) unsigned char storage[Size];
+        };
+
+        // Each slab holds about 64 KiB worth of blocks
+        static constexpr size_t slabBlocks = (65536 / sizeof(Block)) > 16 ? 65536 / sizeof(Block) : 16;
+
+        slab_pool() : freeList(nullptr), cursor(nullptr), end(nullptr) {}
+
+        void grow() {
+            slabs.emplace_back(new Block[slabBlocks]);
+            cursor = slabs.back().get();
+            end = cursor + slabBlocks;
+        }
+
+        void lock() {
+            while (busy.test_and_set(memory_order_acquire)) {
+                this_thread::yield();
+            }
+        }
+
+        void unlock() {
+            busy.clear(memory_order_release);
+        }
+
+        Block* freeList;  // Recycled blocks
+        Block* cursor;    // Next never-used block in the newest slab
+        Block* end;       // One past the last block of the newest slab
+        vector<unique_ptr<Block[]>> slabs;
+        atomic_flag busy = ATOMIC_FLAG_INIT;
+    };
+
+    // Standard allocator handing out single objects from a slab_pool.
+    // Stateless: every instance shares the pool for its block size.
+    template<typename T>
+    struct pool_allocator {
+        using value_type = T;
+
+        pool_allocator() = default;
+
+        template<typename U>
+        pool_allocator(const pool_allocator<U>&) {}
+
+        T* allocate(size_t n) {
+            if (n != 1) {
+                return allocator<T>().allocate(n);
+            }
+            return static_cast<T*>(slab_pool<sizeof(T), alignof(T)>::instance().allocate());
+        }
+
+        void deallocate(T* p, size_t n) {
+            if (n != 1) {
+                allocator<T>().deallocate(p, n);
+                return;
+            }
+            slab_pool<sizeof(T), alignof(T)>::instance().deallocate(p);
+        }
+
+        template<typename U>
+        bool operator==(const pool_allocator<U>&) const {
+            return true;
+        }
+
+        template<typename U>
+        bool operator!=(const pool_allocator<U>&) const {
+            return false;
+        }
+    };
+
+    // Line formatter behind prqueue::toString, write_to and operator<<.
+    // Each element becomes "<priority> value: <value>\n" in a reusable
+    // buffer. Integers go through to_chars and strings are copied as they
+    // are; every other type is printed by one reused ostringstream, so the
+    // text matches what a default-formatted ostream prints. With a sink
+    // the buffer is written out in 64 KiB chunks, otherwise it collects
+    // the whole text.
+    class text_writer {
+    public:
+        explicit text_writer(ostream* sink = nullptr) : sink(sink), expected(0) {}
+
+        // Sizes the buffer for `lines` lines once the first one is known.
+        // With a sink the buffer is flushed once it fills a chunk, so it only
+        // reserves room for a chunk and the line that crosses its end.
+        void expect(size_t lines) {
+            if (sink) {
+                text.reserve(2 * chunk);
+            } else {
+                expected = lines;
+            }
+        }
+
+        template<typename P, typename V>
+        void line(const P& priority, const V& value) {
+            size_t start = text.size();
+            put(priority);
+            text.append(" value: ");
+            put(value);
+            text.push_back('\n');
+            if (expected) {
+                // Guess the rest of the lines are about as long as the first
+                text.reserve(start + (text.size() - start) * expected + 64);
+                expected = 0;
+            }
+            if (sink && text.size() >= chunk) {
+                flush();
+            }
+        }
+
+        void flush() {
+            if (sink && !text.empty()) {
+                sink->write(text.data(), text.size());
+                text.clear();
+            }
+        }
+
+        string take() {
+            return move(text);
+        }
+
+    private:
+        static constexpr size_t chunk = 65536;
+
+        template<typename V>
+        static constexpr bool plainInteger = is_integral_v<V> && !is_same_v<V, bool> &&
+            !is_same_v<V, char> && !is_same_v<V, signed char> && !is_same_v<V, unsigned char> &&
+            !is_same_v<V, wchar_t> && !is_same_v<V, char16_t> && !is_same_v<V, char32_t>;
+
+        template<typename V>
+        void put(const V& item) {
+            if constexpr (plainInteger<V>) {
+                char digits[48];
+                char* end = to_chars(digits, digits + sizeof(digits), item).ptr;
+                text.append(digits, end);
+            } else if constexpr (is_same_v<V, char>) {
+                text.push_back(item);
+            } else if constexpr (is_convertible_v<const V&, string_view>) {
+                text.append(string_view(item));
+            } else {
+                fallback.str(string());
+                fallback.clear();
+                fallback << item;
+                text.append(fallback.str());
+            }
+        }
+
+        ostream* sink;
+        size_t expected;      // Lines announced by expect(), 0 once reserved
+        string text;
+        ostringstream fallback;
+    };
+
+    // What prqueue::stats() reports when PRQUEUE_STATS is 1. stats() measures
+    // the shape fields on the spot; the counters cover the work done since
+    // construction or reset_stats().
+    struct queue_stats {
+        static constexpr int latencyBuckets = 32;
+
+        int height = 0;             // Tree nodes on the longest path down from the root
+        int distinct = 0;           // Tree nodes, one per distinct priority
+        int maxChain = 0;           // Most elements sharing one priority
+        double averageChain = 0;    // Elements per distinct priority
+
+        uint64_t enqueues = 0;       // Insertions into the tree (enqueue, update_priority, merge)
+        uint64_t enqueueVisits = 0;  // Nodes those insertions stepped through, chain walks included
+        uint64_t dequeues = 0;       // Elements taken off the front (dequeue, dequeue_n, dequeue_while)
+        uint64_t dequeueVisits = 0;  // Nodes stepped through to find the new front
+        uint64_t nexts = 0;          // next() calls that produced an element
+        uint64_t nextVisits = 0;     // Nodes next() stepped through to reach the following one
+        uint64_t allocations = 0;    // NODEs taken from the allocator
+        uint64_t deallocations = 0;  // NODEs handed back
+
+        // [i] counts enqueue or dequeue calls that took [2^i, 2^(i+1)) ns; the
+        // first and last buckets also take the shorter and longer ones
+        uint64_t enqueueLatency[latencyBuckets] = {};
+        uint64_t dequeueLatency[latencyBuckets] = {};
+
+        // Helper function adding the time since `start` to `histogram`
+        static void addLatency(uint64_t* histogram, chrono::steady_clock::time_point start) {
+            auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+            int bucket = 0;
+            while (bucket + 1 < latencyBuckets && (int64_t(2) << bucket) <= ns) {
+                bucket++;
+            }
+            histogram[bucket]++;
+        }
+    };
+
+    // Whether V can be written to an ostream
+    template<typename V, typename = void>
+    struct printable : false_type {};
+    template<typename V>
+    struct printable<V, void_t<decltype(declval<ostream&>() << declval<const V&>())>> : true_type {};
+
+    // Whether std::hash<V> is defined
+    template<typename V, typename = void>
+    struct hashable : false_type {};
+    template<typename V>
+    struct hashable<V, void_t<decltype(std::hash<V>()(declval<const V&>()))>> : true_type {};
+
+    // splitmix64 finalizer: spreads every input bit over the whole word
+    inline uint64_t mix64(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    // Content hash behind prqueue::hash_code and std::hash<prqueue>. Every
+    // element contributes term(priority, value) and a queue's hash is the
+    // sum of its terms, so adding or removing an element updates it in O(1)
+    // and queues that compare equal always hash equal. Priorities only take
+    // part under the standard comparators: a custom one may call priorities
+    // equal that std::hash tells apart.
+    template<typename T, typename Priority, typename Compare>
+    struct content_hash {
+        static constexpr bool enabled = hashable<T>::value;
+        static constexpr bool withPriority = hashable<Priority>::value &&
+            (is_same<Compare, less<Priority>>::value || is_same<Compare, greater<Priority>>::value ||
+             is_same<Compare, less<>>::value || is_same<Compare, greater<>>::value);
+
+        // Identity hashes of small ints go through mix64 to spread out
+        static size_t term(const Priority& priority, const T& value) {
+            uint64_t h = mix64(std::hash<T>()(value));
+            if constexpr (withPriority) {
+                h = mix64(h ^ (std::hash<Priority>()(priority) + 0x9e3779b97f4a7c15ULL));
+            }
+            return size_t(h);
+        }
+
+        // Hash of a queue of `count` elements whose terms add up to `sum`
+        static size_t finish(size_t sum, size_t count) {
+            return size_t(mix64(sum + mix64(count)));
+        }
+    };
+
+    // How save() and load() store one priority or value. Trivially copyable
+    // types are written as their bytes and strings as a 64-bit length and
+    // the characters. Other payloads need a specialisation of
+    // prq::serializer<V> with the same three members; `width` is the fixed
+    // record size in bytes, or 0 when it varies.
+    template<typename V>
+    struct serializer {
+        static_assert(is_trivially_copyable_v<V>, "specialise prq::serializer<V> to save this type");
+        static constexpr uint32_t width = sizeof(V);
+
+        static void write(string& out, const V& item) {
+            out.append(reinterpret_cast<const char*>(&item), sizeof(V));
+        }
+
+        static V read(const char*& in, const char* end) {
+            if (size_t(end - in) < sizeof(V)) {
+                throw runtime_error("prqueue: snapshot is truncated");
+            }
+            V item;
+            memcpy(&item, in, sizeof(V));
+            in += sizeof(V);
+            return item;
+        }
+    };
+
+    template<>
+    struct serializer<string> {
+        static constexpr uint32_t width = 0;
+
+        static void write(string& out, const string& item) {
+            serializer<uint64_t>::write(out, item.size());
+            out.append(item);
+        }
+
+        static string read(const char*& in, const char* end) {
+            uint64_t length = serializer<uint64_t>::read(in, end);
+            if (uint64_t(end - in) < length) {
+                throw runtime_error("prqueue: snapshot is truncated");
+            }
+            string item(in, size_t(length));
+            in += length;
+            return item;
+        }
+    };
+
+    // Snapshot files start with this header, followed by `count` records of
+    // (priority, value) in queue order. Fields are in native byte order: a
+    // snapshot is meant to be reloaded by the same build on the same machine.
+    struct snapshot_header {
+        char magic[4];           // "PRQS"
+        uint32_t version;        // Bumped whenever the layout changes
+        uint32_t priorityWidth;  // serializer<Priority>::width
+        uint32_t valueWidth;     // serializer<T>::width
+        uint64_t count;          // Number of records
+    };
+    static constexpr uint32_t snapshot_version = 1;
+
+    // Writes a snapshot of `count` elements through a buffer flushed in 1 MiB
+    // chunks. The records go to a temporary file next to `path` that only
+    // replaces it in finish(), so a crash never leaves half a snapshot behind.
+    template<typename T, typename Priority>
+    class snapshot_writer {
+    public:
+        snapshot_writer(const string& path, size_t count)
+            : path(path), temporary(path + ".tmp"), out(temporary, ios::binary | ios::trunc) {
+            if (!out) {
+                throw runtime_error("prqueue: cannot write snapshot " + temporary);
+            }
+            snapshot_header header = {{'P', 'R', 'Q', 'S'}, snapshot_version,
+                                      serializer<Priority>::width, serializer<T>::width, count};
+            buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+
+        void add(const Priority& priority, const T& value) {
+            serializer<Priority>::write(buffer, priority);
+            serializer<T>::write(buffer, value);
+            if (buffer.size() >= chunk) {
+                flush();
+            }
+        }
+
+        void finish() {
+            flush();
+            out.close();
+            if (!out || std::rename(temporary.c_str(), path.c_str()) != 0) {
+                std::remove(temporary.c_str());
+                throw runtime_error("prqueue: cannot write snapshot " + path);
+            }
+        }
+
+    private:
+        static constexpr size_t chunk = 1 << 20;
+
+        void flush() {
+            out.write(buffer.data(), streamsize(buffer.size()));
+            buffer.clear();
+        }
+
+        string path;
+        string temporary;
+        ofstream out;
+        string buffer;
+    };
+
+    // Read-only view of a whole file: memory-mapped where mmap exists,
+    // read into memory otherwise
+    class mapped_file {
+    public:
+        explicit mapped_file(const string& path) : bytes(nullptr), length(0) {
+#ifdef PRQ_HAVE_MMAP
+            int fd = ::open(path.c_str(), O_RDONLY);
+            struct stat info;
+            if (fd < 0 || fstat(fd, &info) != 0) {
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+                throw runtime_error("prqueue: cannot read snapshot " + path);
+            }
+            length = size_t(info.st_size);
+            if (length > 0) {
+                void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (view == MAP_FAILED) {
+                    ::close(fd);
+                    throw runtime_error("prqueue: cannot map snapshot " + path);
+                }
+                madvise(view, length, MADV_SEQUENTIAL);
+                bytes = static_cast<const char*>(view);
+            }
+            ::close(fd);
+#else
+            ifstream in(path, ios::binary);
+            if (!in) {
+                throw runtime_error("prqueue: cannot read snapshot " + path);
+            }
+            contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+            bytes = contents.data();
+            length = contents.size();
+#endif
+        }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        ~mapped_file() {
+#ifdef PRQ_HAVE_MMAP
+            if (bytes) {
+                munmap(const_cast<char*>(bytes), length);
+            }
+#endif
+        }
+
+        const char* data() const {
+            return bytes;
+        }
+
+        size_t size() const {
+            return length;
+        }
+
+    private:
+        const char* bytes;
+        size_t length;
+#ifndef PRQ_HAVE_MMAP
+        vector<char> contents;
+#endif
+    };
+
+    // Checks a mapped snapshot's header and hands out its records as
+    // (value, priority) pairs, the shape every prqueue::assign takes. Each
+    // record is decoded when its iterator is dereferenced.
+    template<typename T, typename Priority>
+    class snapshot_reader {
+    public:
+        class iterator {
+        public:
+            using iterator_category = input_iterator_tag;
+            using value_type = pair<T, Priority>;
+            using difference_type = ptrdiff_t;
+            using pointer = void;
+            using reference = value_type;
+
+            iterator(const char* pos, const char* end, uint64_t left)
+                : pos(pos), end(end), next(nullptr), left(left) {}
+
+            value_type operator*() const {
+                const char* in = pos;
+                Priority priority = serializer<Priority>::read(in, end);
+                T value = serializer<T>::read(in, end);
+                next = in;
+                return value_type(std::move(value), std::move(priority));
+            }
+
+            iterator& operator++() {
+                if (!next) {
+                    **this;  // Step over a record that was not read
+                }
+                pos = next;
+                next = nullptr;
+                left--;
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const {
+                return left == other.left;
+            }
+
+            bool operator!=(const iterator& other) const {
+                return left != other.left;
+            }
+
+        private:
+            const char* pos;
+            const char* end;
+            mutable const char* next;  // End of the record under pos once decoded
+            uint64_t left;             // Records from pos to the end
+        };
+
+        explicit snapshot_reader(const string& path) : file(path) {
+            snapshot_header expected = {{'P', 'R', 'Q', 'S'}, snapshot_version,
+                                        serializer<Priority>::width, serializer<T>::width, 0};
+            if (file.size() < sizeof(header)) {
+                throw runtime_error("prqueue: " + path + " is not a snapshot");
+            }
+            memcpy(&header, file.data(), sizeof(header));
+            if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0) {
+                throw runtime_error("prqueue: " + path + " is not a snapshot");
+            }
+            if (header.version != expected.version || header.priorityWidth != expected.priorityWidth ||
+                header.valueWidth != expected.valueWidth) {
+                throw runtime_error("prqueue: snapshot " + path + " was saved with another version or types");
+            }
+        }
+
+        uint64_t size() const {
+            return header.count;
+        }
+
+        iterator begin() const {
+            return iterator(file.data() + sizeof(header), file.data() + file.size(), header.count);
+        }
+
+        iterator end() const {
+            return iterator(nullptr, nullptr, 0);
+        }
+
+    private:
+        mapped_file file;
+        snapshot_header header;
+    };
+}
+
+template<typename T, typename Priority = int, typename Compare = less<Priority>,
+         typename Engine = prq::bst, typename Alloc = prq::pool_allocator<T>>
 class prqueue {
+public:
+    // Element as seen through the iterators: its priority and stored value
+    struct entry {
+        Priority priority;  // Used to build the Binary Search Tree (BST)
+        T value;            // Stored data for the priority queue
+
+        // Builds the value in place from `args`, T need not be default-constructible
+        template<typename... Args>
+        entry(const Priority& priority, Args&&... args)
+            : priority(priority), value(std::forward<Args>(args)...) {}
+    };
+
 private:
-    struct NODE {
-        int priority;  // Used to build the Binary Search Tree (BST)
-        T value;       // Stored data for the priority queue
+    struct NODE : entry {
         bool dup;      // Marked true when there are duplicate priorities
+        bool red;      // Colour of the tree node (only used by prq::red_black)
+        int weight;    // Elements under this tree node, duplicates included (only used by prq::ranked)
         NODE* parent;  // Links back to the parent
         NODE* link;    // Links to a linked list of NODEs with duplicate priorities
-        NODE* left;    // Links to the left child
+        NODE* left;    // Links to the left child; in a chain's first duplicate, the chain's last NODE
         NODE* right;   // Links to the right child
+
+        template<typename... Args>
+        NODE(const Priority& priority, Args&&... args)
+            : entry(priority, std::forward<Args>(args)...), dup(false), red(true), weight(1),
+              parent(nullptr), link(nullptr), left(nullptr), right(nullptr) {}
     };
 
-    // Helper function to compare two linked lists for equality
-    bool areLinkedListsEqual(NODE* list1, NODE* list2) const {
-        // Traverse both linked lists and compare their nodes
-        while (list1 != nullptr && list2 != nullptr) {
-            if (list1->priority != list2->priority || list1->value != list2->value) {
-                return false; // Nodes in linked lists are not equal
-            }
-            list1 = list1->link;
-            list2 = list2->link;
-        }
-        
-        // If one of the linked lists is not empty and the other is, they are not equal
-        return list1 == nullptr && list2 == nullptr;
+    using NodeAlloc = typename allocator_traits<Alloc>::template rebind_alloc<NODE>;
+    using NodeTraits = allocator_traits<NodeAlloc>;
+
+    // Helper function to get a NODE from the allocator, constructing its value from `args`
+    template<typename... Args>
+    NODE* createNode(const Priority& priority, Args&&... args) {
+        NODE* node = NodeTraits::allocate(alloc, 1);
+        try {
+            NodeTraits::construct(alloc, node, priority, std::forward<Args>(args)...);
+        } catch (...) {
+            NodeTraits::deallocate(alloc, node, 1);
+            throw;
+        }
+        PRQ_STAT(counters.allocations++;)
+        return node;
+    }
+
+    // Helper function to return a NODE to the allocator
+    void destroyNode(NODE* node) {
+        NodeTraits::destroy(alloc, node);
+        NodeTraits::deallocate(alloc, node, 1);
+        PRQ_STAT(counters.deallocations++;)
+    }
+
+    // Arithmetic priorities under less<> compare with the built-in operators,
+    // so the default int queue compiles to the same code as a hard-wired int
+    static constexpr bool plainOrder =
+        is_arithmetic<Priority>::value && is_same<Compare, less<Priority>>::value;
+
+    // Helper function for the queue order: true when priority `a` comes before `b`
+    bool before(const Priority& a, const Priority& b) const {
+        return comp(a, b);
+    }
+
+    // Helper function telling whether two priorities are equal under the comparator
+    bool samePriority(const Priority& a, const Priority& b) const {
+        if constexpr (plainOrder) {
+            return a == b;
+        } else {
+            return !comp(a, b) && !comp(b, a);
+        }
+    }
+
+    using ContentHash = prq::content_hash<T, Priority, Compare>;
+
+    // Helper function to get an element's share of `contentHash` (0 when T has no std::hash)
+    static size_t elementHash(const NODE* node) {
+        if constexpr (ContentHash::enabled) {
+            return ContentHash::term(node->priority, node->value);
+        } else {
+            return 0;
+        }
+    }
+
+    // Helper function to find the in-order successor of a tree node (chain heads only)
+    static NODE* nextHead(NODE* node) {
+        if (node->right) {
+            node = node->right;
+            while (node->left) {
+                node = node->left;
+            }
+            return node;
+        }
+        // Climb until we come up from a left child
+        while (node->parent && node == node->parent->right) {
+            node = node->parent;
+        }
+        return node->parent;
+    }
+
+    // Helper function to find the in-order predecessor of a tree node (chain heads only)
+    static NODE* prevHead(NODE* node) {
+        if (node->left) {
+            node = node->left;
+            while (node->right) {
+                node = node->right;
+            }
+            return node;
+        }
+        // Climb until we come up from a right child
+        while (node->parent && node == node->parent->left) {
+            node = node->parent;
+        }
+        return node->parent;
+    }
+
+    // Helper function to step to the next element in queue order (nullptr at the end)
+    static NODE* nextNode(NODE* node) {
+        if (node->link) {
+            return node->link;
+        }
+        // Back to the head of the duplicate chain, then on to the next tree node
+        while (node->dup) {
+            node = node->parent;
+        }
+        return nextHead(node);
+    }
+
+    // Helper function to step to the previous element in queue order (nullptr at the start)
+    static NODE* prevNode(NODE* node) {
+        if (node->dup) {
+            return node->parent;
+        }
+        return lastInChain(prevHead(node));
+    }
+
+    // Helper function to get the last duplicate of a chain (passes nullptr through)
+    static NODE* lastInChain(NODE* node) {
+        return node ? chainTail(node) : nullptr;
+    }
+
+    // Helper function to get the last NODE of the chain behind tree node `head`.
+    // Duplicates have no children, so the first duplicate keeps the chain's
+    // tail in its `left`, making appends O(1) without a field in every NODE.
+    static NODE* chainTail(NODE* head) {
+        return head->link ? head->link->left : head;
+    }
+
+    // Helper function to record `tail` as the last NODE of the chain behind `head`
+    static void setChainTail(NODE* head, NODE* tail) {
+        if (head->link) {
+            head->link->left = tail;
+        }
+    }
+
+    // Helper function to get the element count of a subtree (0 for nullptr; prq::ranked only)
+    static int weightOf(const NODE* node) {
+        return node ? node->weight : 0;
+    }
+
+    // Helper function to get the length of the duplicate chain headed by a tree node (prq::ranked only)
+    static int chainWeight(const NODE* head) {
+        return head->weight - weightOf(head->left) - weightOf(head->right);
+    }
+
+    // Helper function to add `delta` to the counts of tree node `node` and its ancestors (prq::ranked only)
+    static void addWeight(NODE* node, int delta) {
+        for (; node; node = node->parent) {
+            node->weight += delta;
+        }
+    }
+
+    // Helper function to count the NODEs in a duplicate chain by walking it
+    static int chainLength(const NODE* head) {
+        int length = 0;
+        for (; head; head = head->link) {
+            length++;
+        }
+        return length;
+    }
+
+    // Helper function to find the tree node holding `priority` (nullptr if none)
+    NODE* findHead(const Priority& priority) const {
+        NODE* node = root;
+        while (node) {
+            if (before(priority, node->priority)) {
+                node = node->left;
+            } else if (before(node->priority, priority)) {
+                node = node->right;
+            } else {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    // Helper function for converting the prqueue to a string, walking the
+    // tree in order through parent links so deep trees cannot overflow the stack
+    void _toStringInorder(prq::text_writer& output) const {
+        output.expect(sz);
+        for (NODE* node = first; node; node = nextHead(node)) {
+            // Format and append the node and its duplicate priorities
+            for (NODE* current = node; current; current = current->link) {
+                output.line(current->priority, current->value);
+            }
+        }
+    }
+
+    // Helper function to copy one tree node together with its duplicate chain
+    NODE* copyNode(NODE* otherNode) {
+        NODE* newNode = createNode(otherNode->priority, otherNode->value);
+        newNode->red = otherNode->red;
+        newNode->weight = otherNode->weight;
+        try {
+            newNode->link = copyLinkedList(otherNode->link);  // Copy the linked list
+        } catch (...) {
+            destroyNode(newNode);
+            throw;
+        }
+        if (newNode->link) {
+            newNode->link->parent = newNode;
+            NODE* tail = newNode->link;
+            while (tail->link) {
+                tail = tail->link;
+            }
+            setChainTail(newNode, tail);
+        }
+        return newNode;
+    }
+
+    // Helper function to create a deep copy of a BST. The source is walked
+    // through its parent links (pre-order) while the copy is built alongside,
+    // so only O(1) extra space is used whatever the depth.
+    NODE* copyTree(NODE* otherNode) {
+        if (otherNode == nullptr) {
+            return nullptr;
+        }
+
+        NODE* newRoot = copyNode(otherNode);
+        NODE* source = otherNode;
+        NODE* target = newRoot;
+        try {
+            while (true) {
+                if (source->left && !target->left) {
+                    // Copy and descend into the left subtree first
+                    target->left = copyNode(source->left);
+                    target->left->parent = target;
+                    source = source->left;
+                    target = target->left;
+                } else if (source->right && !target->right) {
+                    target->right = copyNode(source->right);
+                    target->right->parent = target;
+                    source = source->right;
+                    target = target->right;
+                } else if (source != otherNode) {
+                    // Both subtrees done, go back up
+                    source = source->parent;
+                    target = target->parent;
+                } else {
+                    break;
+                }
+            }
+        } catch (...) {
+            clearTree(newRoot);
+            throw;
+        }
+
+        return newRoot;
+    }
+
+    // Helper function to create a deep copy of a linked list
+    NODE* copyLinkedList(NODE* otherHead) {
+        NODE* newHead = nullptr;
+        NODE* current = nullptr;
+
+        while (otherHead) {
+            NODE* newNode;
+            try {
+                newNode = createNode(otherHead->priority, otherHead->value);
+            } catch (...) {
+                clearChain(newHead);
+                throw;
+            }
+            newNode->dup = otherHead->dup;
+            newNode->red = false;
+
+            if (current) {
+                current->link = newNode;
+                newNode->parent = current;
+                current = newNode;
+            } else {
+                newHead = newNode;
+                current = newNode;
+            }
+
+            otherHead = otherHead->link;
+        }
+
+        return newHead;
+    }
+
+    // Helper function to free a linked list of NODEs
+    void clearChain(NODE* current) {
+        while (current) {
+            NODE* temp = current;
+            current = current->link;
+            destroyNode(temp);
+        }
+    }
+
+    // Function to clear the tree and free memory. Left children are rotated
+    // up until the node has none, then it is freed and we move right, so no
+    // stack is needed even for a tree that is one long path.
+    void clearTree(NODE* node) {
+        while (node) {
+            if (node->left) {
+                NODE* leftChild = node->left;
+                node->left = leftChild->right;
+                leftChild->right = node;
+                node = leftChild;
+            } else {
+                NODE* rightChild = node->right;
+                clearChain(node->link);
+                destroyNode(node);
+                node = rightChild;
+            }
+        }
+    }
+
+    // Helper function to build a balanced tree over the chain heads in [lo, hi),
+    // which are sorted by priority. Every level is full except possibly the
+    // deepest one, whose nodes are coloured red so red_black rules hold.
+    // prq::ranked expects each head's count to hold its chain length.
+    NODE* buildTree(vector<NODE*>& heads, size_t lo, size_t hi, int depth, int redDepth) {
+        if (lo >= hi) {
+            return nullptr;
+        }
+
+        size_t mid = lo + (hi - lo) / 2;
+        NODE* node = heads[mid];
+        node->red = (depth == redDepth);
+        node->left = buildTree(heads, lo, mid, depth + 1, redDepth);
+        node->right = buildTree(heads, mid + 1, hi, depth + 1, redDepth);
+
+        if (node->left) {
+            node->left->parent = node;
+        }
+        if (node->right) {
+            node->right->parent = node;
+        }
+        if constexpr (Engine::counted) {
+            node->weight += weightOf(node->left) + weightOf(node->right);
+        }
+        return node;
+    }
+
+    // Helper function to get the highest priority tree node under `node`
+    static NODE* lastHead(NODE* node) {
+        while (node->right) {
+            node = node->right;
+        }
+        return node;
+    }
+
+    // Helper function counting the black tree nodes on the path from `node` down
+    // to a leaf (the same on every path in a red-black tree)
+    static int blackHeight(NODE* node) {
+        int height = 0;
+        for (; node; node = node->left) {
+            if (!node->red) {
+                height++;
+            }
+        }
+        return height;
+    }
+
+    // Helper function to make one tree of `lower` (may be null), `pivot` and
+    // `higher` (may be null), where every priority in `lower` comes before
+    // pivot's and every priority in `higher` after it. The red_black engine
+    // hangs the pivot where the black heights match and recolours up from
+    // there, in O(log n); the plain BST puts the pivot on top. Returns the new
+    // root. prq::ranked expects the pivot's count to hold its chain length.
+    NODE* joinTrees(NODE* lower, NODE* pivot, NODE* higher) {
+        pivot->dup = false;
+        pivot->red = true;
+        pivot->parent = nullptr;
+        pivot->left = lower;
+        pivot->right = higher;
+
+        if constexpr (Engine::balanced) {
+            int lowerHeight = blackHeight(lower);
+            int higherHeight = blackHeight(higher);
+            NODE* parent = nullptr;
+            if (lowerHeight >= higherHeight) {
+                // Down the right spine of `lower` to a black node as high as `higher`
+                NODE* node = lower;
+                for (int height = lowerHeight; node && (node->red || height > higherHeight); node = node->right) {
+                    if (!node->red) {
+                        height--;
+                    }
+                    parent = node;
+                }
+                pivot->left = node;
+                if (parent) {
+                    parent->right = pivot;
+                }
+                root = parent ? lower : pivot;
+            } else {
+                // Down the left spine of `higher` to a black node as high as `lower`
+                NODE* node = higher;
+                for (int height = higherHeight; node && (node->red || height > lowerHeight); node = node->left) {
+                    if (!node->red) {
+                        height--;
+                    }
+                    parent = node;
+                }
+                pivot->right = node;
+                if (parent) {
+                    parent->left = pivot;
+                }
+                root = parent ? higher : pivot;
+            }
+            pivot->parent = parent;
+        } else {
+            root = pivot;
+        }
+
+        if (pivot->left) {
+            pivot->left->parent = pivot;
+        }
+        if (pivot->right) {
+            pivot->right->parent = pivot;
+        }
+        if constexpr (Engine::counted) {
+            // The spine above the pivot gains its chain and the tree beside it
+            int chain = pivot->weight;
+            pivot->weight = chain + weightOf(pivot->left) + weightOf(pivot->right);
+            if (pivot->parent) {
+                NODE* beside = pivot == pivot->parent->right ? pivot->right : pivot->left;
+                addWeight(pivot->parent, chain + weightOf(beside));
+            }
+        }
+        if constexpr (Engine::balanced) {
+            insertFixup(pivot);
+        }
+        return root;
+    }
+
+    // Helper function to cut the subtree under `node` loose so it can be
+    // joined as a tree of its own (a red root turns black, which keeps it valid)
+    static NODE* detachSubtree(NODE* node) {
+        if (node) {
+            node->parent = nullptr;
+            node->red = false;
+        }
+        return node;
+    }
+
+    // Helper function to get the lowest priority tree node under `node` (passes nullptr through)
+    static NODE* firstHead(NODE* node) {
+        while (node && node->left) {
+            node = node->left;
+        }
+        return node;
+    }
+
+    // Helper function to cut the tree along the search path for `priority`.
+    // Bottom-up, each path node joins its off-path subtree to the part already
+    // built on its side. The part before `priority` is returned as a tree of
+    // its own (lowest node in `lowFirst`), this queue keeps the rest; `sz` is
+    // left to the caller.
+    NODE* cutBelow(const Priority& priority, NODE*& lowFirst) {
+        lowFirst = nullptr;
+        if (!root || !before(first->priority, priority)) {
+            return nullptr;
+        }
+
+        vector<NODE*> path;
+        for (NODE* node = root; node;) {
+            path.push_back(node);
+            node = before(node->priority, priority) ? node->right : node->left;
+        }
+        vector<int> chains;  // Chain lengths of the path nodes (prq::ranked only)
+        if constexpr (Engine::counted) {
+            for (NODE* node : path) {
+                chains.push_back(chainWeight(node));
+            }
+        }
+        NODE* low = nullptr;
+        NODE* high = nullptr;
+        for (size_t i = path.size(); i-- > 0;) {
+            NODE* node = path[i];
+            if constexpr (Engine::counted) {
+                node->weight = chains[i];
+            }
+            if (before(node->priority, priority)) {
+                low = joinTrees(detachSubtree(node->left), node, low);
+            } else {
+                high = joinTrees(high, node, detachSubtree(node->right));
+            }
+        }
+
+        lowFirst = first;
+        root = high;
+        first = firstHead(high);
+        curr = nullptr;
+        return low;
+    }
+
+    // Helper function to join a tree whose priorities all come before ours
+    // (the lower part from cutBelow) back on in O(log n); `sz` is left to the caller
+    void joinBelow(NODE* lowRoot, NODE* lowFirst) {
+        if (!lowRoot) {
+            return;
+        }
+        if (!root) {
+            root = lowRoot;
+            first = lowFirst;
+            return;
+        }
+        NODE* pivot = first;
+        int chain = chainWeight(pivot);
+        detachFirstChain();
+        if constexpr (Engine::counted) {
+            pivot->weight = chain;
+        }
+        joinTrees(lowRoot, pivot, root);
+        first = lowFirst;
+    }
+
+    // Helper function to rotate a tree node down to the left (red_black only)
+    void rotateLeft(NODE* node) {
+        NODE* pivot = node->right;
+
+        node->right = pivot->left;
+        if (pivot->left) {
+            pivot->left->parent = node;
+        }
+
+        pivot->parent = node->parent;
+        if (node->parent == nullptr) {
+            root = pivot;
+        } else if (node == node->parent->left) {
+            node->parent->left = pivot;
+        } else {
+            node->parent->right = pivot;
+        }
+
+        pivot->left = node;
+        node->parent = pivot;
+
+        // The pivot now counts what the node did; the node lost the pivot's right side
+        if constexpr (Engine::counted) {
+            int total = node->weight;
+            node->weight += weightOf(node->right) - pivot->weight;
+            pivot->weight = total;
+        }
+    }
+
+    // Helper function to rotate a tree node down to the right (red_black only)
+    void rotateRight(NODE* node) {
+        NODE* pivot = node->left;
+
+        node->left = pivot->right;
+        if (pivot->right) {
+            pivot->right->parent = node;
+        }
+
+        pivot->parent = node->parent;
+        if (node->parent == nullptr) {
+            root = pivot;
+        } else if (node == node->parent->right) {
+            node->parent->right = pivot;
+        } else {
+            node->parent->left = pivot;
+        }
+
+        pivot->right = node;
+        node->parent = pivot;
+
+        if constexpr (Engine::counted) {
+            int total = node->weight;
+            node->weight += weightOf(node->left) - pivot->weight;
+            pivot->weight = total;
+        }
+    }
+
+    // Helper function to restore the red-black rules after a new tree node
+    // was attached as a red leaf. Duplicate chain nodes never get here.
+    void insertFixup(NODE* node) {
+        while (node->parent && node->parent->red) {
+            NODE* parent = node->parent;
+            NODE* grand = parent->parent;  // Exists, a red node is never the root
+
+            if (parent == grand->left) {
+                NODE* uncle = grand->right;
+                if (uncle && uncle->red) {
+                    // Red uncle: push the blackness down from the grandparent
+                    parent->red = false;
+                    uncle->red = false;
+                    grand->red = true;
+                    node = grand;
+                } else {
+                    if (node == parent->right) {
+                        rotateLeft(parent);
+                        node = parent;
+                        parent = node->parent;
+                    }
+                    parent->red = false;
+                    grand->red = true;
+                    rotateRight(grand);
+                }
+            } else {
+                NODE* uncle = grand->left;
+                if (uncle && uncle->red) {
+                    parent->red = false;
+                    uncle->red = false;
+                    grand->red = true;
+                    node = grand;
+                } else {
+                    if (node == parent->left) {
+                        rotateRight(parent);
+                        node = parent;
+                        parent = node->parent;
+                    }
+                    parent->red = false;
+                    grand->red = true;
+                    rotateLeft(grand);
+                }
+            }
+        }
+        root->red = false;
+    }
+
+    // Helper function to restore the red-black rules after a black tree node
+    // was unlinked. `node` took its place (and may be null), `parent` is its parent.
+    void eraseFixup(NODE* node, NODE* parent) {
+        while (node != root && (node == nullptr || !node->red)) {
+            if (node == parent->left) {
+                NODE* sibling = parent->right;
+                if (sibling->red) {
+                    sibling->red = false;
+                    parent->red = true;
+                    rotateLeft(parent);
+                    sibling = parent->right;
+                }
+                bool leftBlack = sibling->left == nullptr || !sibling->left->red;
+                bool rightBlack = sibling->right == nullptr || !sibling->right->red;
+                if (leftBlack && rightBlack) {
+                    sibling->red = true;
+                    node = parent;
+                    parent = node->parent;
+                } else {
+                    if (rightBlack) {
+                        sibling->left->red = false;
+                        sibling->red = true;
+                        rotateRight(sibling);
+                        sibling = parent->right;
+                    }
+                    sibling->red = parent->red;
+                    parent->red = false;
+                    sibling->right->red = false;
+                    rotateLeft(parent);
+                    node = root;
+                }
+            } else {
+                NODE* sibling = parent->left;
+                if (sibling->red) {
+                    sibling->red = false;
+                    parent->red = true;
+                    rotateRight(parent);
+                    sibling = parent->left;
+                }
+                bool leftBlack = sibling->left == nullptr || !sibling->left->red;
+                bool rightBlack = sibling->right == nullptr || !sibling->right->red;
+                if (leftBlack && rightBlack) {
+                    sibling->red = true;
+                    node = parent;
+                    parent = node->parent;
+                } else {
+                    if (leftBlack) {
+                        sibling->right->red = false;
+                        sibling->red = true;
+                        rotateLeft(sibling);
+                        sibling = parent->left;
+                    }
+                    sibling->red = parent->red;
+                    parent->red = false;
+                    sibling->left->red = false;
+                    rotateRight(parent);
+                    node = root;
+                }
+            }
+        }
+        if (node) {
+            node->red = false;
+        }
+    }
+
+    // Helper function to unlink the lowest priority node (`first`) from the
+    // tree without freeing it, and move `first` to its successor
+    void detachFirst() {
+        NODE* current = first;
+        PRQ_STAT(counters.dequeueVisits++;)
+
+        // Remove the lowest-priority element
+        if (current->link) {
+            // Promote the next duplicate into the tree position of the current node
+            first = current->link;
+            replaceInTree(current, current->link);
+        } else {
+            detachFirstChain();
+        }
+    }
+
+    // Helper function to unlink the lowest tree node from the tree together
+    // with its whole duplicate chain, and update `first`
+    void detachFirstChain() {
+        NODE* current = first;
+        NODE* parent = current->parent;
+        if constexpr (Engine::counted) {
+            addWeight(parent, -chainWeight(current));
+        }
+
+        // Find the node that becomes the minimum once this one is gone
+        if (current->right) {
+            first = current->right;
+            while (first->left) {
+                PRQ_STAT(counters.dequeueVisits++;)
+                first = first->left;
+            }
+        } else {
+            first = parent;
+        }
+
+        if (parent) {
+            // Otherwise, update the parent's left child to the right child of the current node
+            parent->left = current->right;
+        } else {
+            // Root case to replace root if it is the next to get dequeued
+            root = current->right;
+        }
+        if (current->right) {
+            // Set the right path with the parent that lost its other child
+            current->right->parent = parent;
+        }
+
+        // A black node left the tree, rebalance (red_black engine only)
+        if constexpr (Engine::balanced) {
+            if (!current->red) {
+                eraseFixup(current->right, parent);
+            }
+        }
+    }
+
+    // Helper function to put `newNode` (a duplicate of `oldNode`) into the
+    // tree position of `oldNode`, taking over its parent, children and colour.
+    // `oldNode` leaves the queue.
+    void replaceInTree(NODE* oldNode, NODE* newNode) {
+        NODE* parent = oldNode->parent;
+        NODE* tail = chainTail(oldNode);
+        if (parent == nullptr) {
+            root = newNode;
+        } else if (parent->left == oldNode) {
+            parent->left = newNode;
+        } else {
+            parent->right = newNode;
+        }
+        newNode->dup = false;
+        newNode->red = oldNode->red;
+        newNode->parent = parent;
+        newNode->left = oldNode->left;
+        newNode->right = oldNode->right;
+        if (newNode->left) {
+            newNode->left->parent = newNode;
+        }
+        if (newNode->right) {
+            newNode->right->parent = newNode;
+        }
+        setChainTail(newNode, tail);
+        if constexpr (Engine::counted) {
+            newNode->weight = oldNode->weight - 1;
+            addWeight(parent, -1);
+        }
+    }
+
+    // Helper function to hang `child` (may be null) where the tree node `node` was
+    void transplant(NODE* node, NODE* child) {
+        if (node->parent == nullptr) {
+            root = child;
+        } else if (node == node->parent->left) {
+            node->parent->left = child;
+        } else {
+            node->parent->right = child;
+        }
+        if (child) {
+            child->parent = node->parent;
+        }
+    }
+
+    // Helper function to unlink any node from the queue without freeing it:
+    // a duplicate is spliced out of its chain, a chain head hands its tree
+    // position to the next duplicate, and a lone tree node is deleted from
+    // the tree (red-black rebalanced when the engine asks for it)
+    void unlinkNode(NODE* node) {
+        if (curr == node) {
+            curr = nextNode(node);  // Keep a running begin()/next() walk valid
+        }
+
+        if (node->dup) {
+            if constexpr (Engine::counted) {
+                NODE* head = node;
+                while (head->dup) {
+                    head = head->parent;
+                }
+                addWeight(head, -1);
+            }
+            NODE* prev = node->parent;
+            if (!prev->dup) {
+                // The first duplicate hands the chain's tail to the next one
+                if (node->link) {
+                    node->link->left = node->left;
+                }
+            } else if (!node->link) {
+                // The tail leaves: walk back to the first duplicate to record the new one
+                NODE* firstDup = prev;
+                while (firstDup->parent->dup) {
+                    firstDup = firstDup->parent;
+                }
+                firstDup->left = prev;
+            }
+            node->left = nullptr;
+            prev->link = node->link;
+            if (node->link) {
+                node->link->parent = prev;
+            }
+            return;
+        }
+
+        if (node == first) {
+            detachFirst();
+            return;
+        }
+
+        if (node->link) {
+            replaceInTree(node, node->link);
+            return;
+        }
+
+        NODE* child;        // Node that moves into the hole (may be null)
+        NODE* childParent;  // Its parent afterwards
+        bool removedRed;    // Colour that left its old tree position
+        if (node->left == nullptr || node->right == nullptr) {
+            child = node->left ? node->left : node->right;
+            childParent = node->parent;
+            removedRed = node->red;
+            if constexpr (Engine::counted) {
+                addWeight(node->parent, -1);
+            }
+            transplant(node, child);
+        } else {
+            // Two children: the in-order successor takes the node's place
+            NODE* successor = node->right;
+            while (successor->left) {
+                successor = successor->left;
+            }
+            removedRed = successor->red;
+            child = successor->right;
+            if constexpr (Engine::counted) {
+                // The successor's chain moves up past its ancestors below `node`
+                int moved = chainWeight(successor);
+                for (NODE* above = successor->parent; above != node; above = above->parent) {
+                    above->weight -= moved;
+                }
+                successor->weight = node->weight - 1;
+                addWeight(node->parent, -1);
+            }
+            if (successor->parent == node) {
+                childParent = successor;
+            } else {
+                childParent = successor->parent;
+                transplant(successor, successor->right);
+                successor->right = node->right;
+                successor->right->parent = successor;
+            }
+            transplant(node, successor);
+            successor->left = node->left;
+            successor->left->parent = successor;
+            successor->red = node->red;
+        }
+
+        // A black node left the tree, rebalance (red_black engine only)
+        if constexpr (Engine::balanced) {
+            if (!removedRed) {
+                eraseFixup(child, childParent);
+            }
+        }
+    }
+
+    // Helper function to link a fresh NODE (no tree links, red) into the tree
+    // in the correct location based on its priority. Does not touch `sz`.
+    // A duplicate chain behind it comes along; prq::ranked expects its count
+    // to hold the chain length.
+    void insertNode(NODE* newNode) {
+        const Priority& priority = newNode->priority;
+        PRQ_STAT(counters.enqueues++;)
+
+        // If the tree is empty, set the new node as the root
+        if (root == nullptr) {
+            newNode->red = false;
+            root = newNode;
+            first = newNode;
+            return;
+        }
+
+        // Initialize pointers for traversal
+        NODE* beforeNode = nullptr;
+        NODE* present = root;
+
+        // Anything at or below the current minimum lands next to the leftmost
+        // node, so skip the descent from the root
+        if (!before(first->priority, priority)) {
+            beforeNode = first;
+            present = before(priority, first->priority) ? nullptr : first;
+            if constexpr (Engine::counted) {
+                addWeight(present ? first->parent : first, newNode->weight);
+            }
+        }
+
+        // Traverse the tree to find the appropriate location for the new node
+        while (present) {
+            beforeNode = present;
+            PRQ_STAT(counters.enqueueVisits++;)
+            if constexpr (Engine::counted) {
+                present->weight += newNode->weight;  // Everything on the way down gains the new node
+            }
+
+            if (before(priority, present->priority)) {
+                present = present->left;
+            } else if (before(present->priority, priority)) {
+                present = present->right;
+            } else {
+                // If a node with the same priority is found, mark the new node as a duplicate
+                // and add it (with any chain of its own) at the end of the chain
+                newNode->dup = true;
+                NODE* tail = chainTail(present);
+                NODE* newTail = chainTail(newNode);
+                if (newNode->link) {
+                    newNode->link->left = nullptr;  // No longer the first duplicate
+                }
+                tail->link = newNode;
+                newNode->parent = tail;
+                setChainTail(present, newTail);
+                return;
+            }
+        }
+
+        // Insert the new node as the left or right child of the previous node based on priority
+        if (before(priority, beforeNode->priority)) {
+            beforeNode->left = newNode;
+            if (beforeNode == first) {
+                first = newNode; // New lowest priority
+            }
+        } else {
+            beforeNode->right = newNode;
+        }
+
+        // Set the parent of the new node
+        newNode->parent = beforeNode;
+
+        // Recolour and rotate back into balance (red_black engine only)
+        if constexpr (Engine::balanced) {
+            insertFixup(newNode);
+        }
+    }
+
+    // Helper function behind dequeue_n and dequeue_while. Walks forward from
+    // `first`; a duplicate chain that is taken completely is freed in one go
+    // and its head unlinked once, instead of promoting every duplicate.
+    template<typename Pred, typename OutputIt>
+    OutputIt drain(Pred take, OutputIt out) {
+        while (first) {
+            NODE* head = first;
+            NODE* node = head;
+            while (node && take(static_cast<const T&>(node->value), node->priority)) {
+                size_t taken = elementHash(node);
+                *out = std::move(node->value);
+                ++out;
+                PRQ_STAT(counters.dequeues++;)
+                contentHash -= taken;
+                node = node->link;
+            }
+            if (node == head) {
+                break;  // Nothing more to take
+            }
+
+            // Free the taken duplicates behind the head
+            NODE* tail = chainTail(head);
+            NODE* dupNode = head->link;
+            int freed = 0;
+            while (dupNode != node) {
+                NODE* temp = dupNode;
+                dupNode = dupNode->link;
+                destroyNode(temp);
+                freed++;
+            }
+            sz -= freed;
+            if constexpr (Engine::counted) {
+                addWeight(head, -freed);
+            }
+
+            // Unlink the head; an untaken rest of the chain is promoted in its place
+            head->link = node;
+            if (node) {
+                node->parent = head;
+                setChainTail(head, tail);
+            }
+            detachFirst();
+            destroyNode(head);
+            sz--;
+
+            if (node) {
+                break;  // The predicate stopped inside this chain
+            }
+        }
+        return out;
+    }
+
+    NODE* root; // Pointer to root node of the BST
+    int sz;     // Number of elements in the prqueue
+    NODE* curr; // Pointer to the next item in prqueue (used for traversal)
+    NODE* first; // Pointer to the leftmost (lowest priority) tree node
+    NodeAlloc alloc; // Allocator for the NODEs
+    Compare comp;    // Orders the priorities
+    size_t contentHash;  // Sum of elementHash over every element, see hash_code()
+#if PRQUEUE_STATS
+    prq::queue_stats counters;  // Work done so far, see stats()
+#endif
+
+public:
+    // Default constructor
+    prqueue() : root(nullptr), sz(0), curr(nullptr), first(nullptr), contentHash(0) {
+        // Initialize the private members:
+        // - `root` is set to nullptr, indicating an empty tree.
+        // - `sz` is set to 0, indicating that there are no elements in the priority queue.
+        // - `curr` is set to nullptr, as there's no current item in the queue.
+        // - `first` is set to nullptr, as there's no lowest priority node yet.
+        // - `contentHash` is set to 0, the hash of no elements.
+    }
+
+    // Constructor with a comparator object (for comparators that carry state)
+    explicit prqueue(const Compare& compare) : prqueue() {
+        comp = compare;
+    }
+
+    // Copy constructor: Makes a deep copy of `other`
+    prqueue(const prqueue& other) : prqueue() {
+        *this = other;
+    }
+
+    // Move constructor: Takes over the nodes of `other`, leaving it empty.
+    // No node is copied or allocated, and handles stay valid.
+    prqueue(prqueue&& other) noexcept
+        : root(other.root), sz(other.sz), curr(other.curr), first(other.first),
+          alloc(std::move(other.alloc)), comp(std::move(other.comp)), contentHash(other.contentHash) {
+        other.root = nullptr;
+        other.sz = 0;
+        other.curr = nullptr;
+        other.first = nullptr;
+        other.contentHash = 0;
+    }
+
+    // Range constructor: Builds the queue from (value, priority) pairs, see assign()
+    template<typename InputIt>
+    prqueue(InputIt from, InputIt to) : prqueue() {
+        assign(from, to);
+    }
+
+    // Move assignment: Frees the current nodes and takes over those of `other`
+    prqueue& operator=(prqueue&& other) noexcept {
+        if (this != &other) {
+            clear();
+            swap(other);
+        }
+        return *this;
+    }
+
+    // Swap: Exchanges the contents of two queues in O(1)
+    void swap(prqueue& other) noexcept {
+        std::swap(root, other.root);
+        std::swap(sz, other.sz);
+        std::swap(curr, other.curr);
+        std::swap(first, other.first);
+        std::swap(alloc, other.alloc);
+        std::swap(comp, other.comp);
+        std::swap(contentHash, other.contentHash);
+    }
+
+    // Assignment operator
+    prqueue& operator=(const prqueue& other) {
+        // Step 1: Check for self-assignment
+        if (this == &other) {
+            return *this;  // Return the current object if self-assignment
+        }
+
+        // Step 2: Clear the current object
+        clear();
+        comp = other.comp;
+
+        // Step 3: Make a deep copy of the 'other' priority queue
+        if (other.root) {
+            root = copyTree(other.root); // Create a deep copy of the other tree
+            first = root;
+            while (first->left) {
+                first = first->left;
+            }
+        }
+        sz = other.sz;
+        contentHash = other.contentHash;
+        curr = nullptr; // Reset the 'curr' pointer
+
+        return *this;
+    }
+
+    // Clear function to free memory associated with the priority queue
+    void clear() {
+        clearTree(root);
+        root = nullptr;
+        sz = 0;
+        curr = nullptr;
+        first = nullptr;
+        contentHash = 0;
+    }
+
+    // Destructor to free the memory associated with the priority queue
+    ~prqueue() {
+        clear();
+    }
+
+    // Assign: Replaces the contents with the (value, priority) pairs in [from, to).
+    // The pairs are sorted once (skipped when already sorted) and the tree is
+    // built balanced in linear time; equal priorities keep their range order.
+    template<typename InputIt>
+    void assign(InputIt from, InputIt to) {
+        clear();
+
+        vector<NODE*> nodes;
+        try {
+            for (; from != to; ++from) {
+                auto&& entry = *from;
+                nodes.push_back(createNode(entry.second, std::forward<decltype(entry)>(entry).first));
+            }
+        } catch (...) {
+            for (NODE* node : nodes) {
+                destroyNode(node);
+            }
+            throw;
+        }
+        if (nodes.empty()) {
+            return;
+        }
+        for (const NODE* node : nodes) {
+            contentHash += elementHash(node);
+        }
+
+        auto byPriority = [this](const NODE* a, const NODE* b) {
+            return before(a->priority, b->priority);
+        };
+        if (!is_sorted(nodes.begin(), nodes.end(), byPriority)) {
+            stable_sort(nodes.begin(), nodes.end(), byPriority);
+        }
+
+        // Chain equal priorities behind their first node, which joins the tree
+        vector<NODE*> heads;
+        NODE* tail = nullptr;
+        for (NODE* node : nodes) {
+            if (tail && samePriority(tail->priority, node->priority)) {
+                tail->link = node;
+                node->parent = tail;
+                node->dup = true;
+                node->red = false;
+                setChainTail(heads.back(), node);
+                if constexpr (Engine::counted) {
+                    heads.back()->weight++;
+                }
+            } else {
+                heads.push_back(node);
+            }
+            tail = node;
+        }
+
+        // Depth of the deepest, possibly incomplete, level
+        int redDepth = 0;
+        while ((size_t(2) << redDepth) <= heads.size()) {
+            redDepth++;
+        }
+
+        root = buildTree(heads, 0, heads.size(), 0, redDepth);
+        root->parent = nullptr;
+        root->red = false;
+        first = heads.front();
+        sz = int(nodes.size());
+    }
+
+    // Merge: Moves every element of `other` into this queue, leaving `other`
+    // empty. NODEs are relinked, never copied or reallocated, so handles into
+    // `other` now point into this queue. Equal priorities keep FIFO order with
+    // this queue's elements first. When every priority of one queue comes
+    // before every priority of the other, the trees are joined in O(log n);
+    // otherwise `other` is linked in one duplicate chain at a time, in
+    // O(m log(n + m)) for m chains.
+    void merge(prqueue&& other) {
+        if (this == &other || !other.root) {
+            return;
+        }
+        if (!root) {
+            swap(other);
+            return;
+        }
+
+        int total = sz + other.sz;
+        if (before(lastHead(root)->priority, other.first->priority)) {
+            // All of ours first: the lowest chain of `other` joins the trees
+            NODE* pivot = other.first;
+            int chain = chainWeight(pivot);
+            other.detachFirstChain();
+            if constexpr (Engine::counted) {
+                pivot->weight = chain;
+            }
+            joinTrees(root, pivot, other.root);
+        } else if (before(lastHead(other.root)->priority, first->priority)) {
+            // All of theirs first: our lowest chain joins the trees
+            joinBelow(other.root, other.first);
+        } else {
+            // Interleaved: each head takes its duplicate chain along, into the
+            // tree or onto the end of an equal chain. Heads are listed first,
+            // as relinking one breaks the in-order walk of `other`.
+            vector<NODE*> heads;
+            for (NODE* node = other.first; node; node = nextHead(node)) {
+                heads.push_back(node);
+            }
+            for (NODE* head : heads) {
+                if constexpr (Engine::counted) {
+                    head->weight = chainLength(head);
+                }
+                head->red = true;
+                head->parent = nullptr;
+                head->left = nullptr;
+                head->right = nullptr;
+                insertNode(head);
+            }
+        }
+
+        sz = total;
+        contentHash += other.contentHash;
+        other.root = nullptr;
+        other.sz = 0;
+        other.curr = nullptr;
+        other.first = nullptr;
+        other.contentHash = 0;
+    }
+
+    // Split: Moves every element with a priority before `priority` into a new
+    // queue and returns it. Whole subtrees and duplicate chains move without
+    // copying and handles stay valid. The cut is O(log n) for red_black
+    // (O(depth) for bst); sizing the two parts and sharing out the content
+    // hash walks whichever is smaller. Under prq::ranked the counts give the
+    // size, so only hashable values need the walk.
+    prqueue split(const Priority& priority) {
+        prqueue lower(comp);
+        lower.alloc = alloc;
+        NODE* lowFirst;
+        NODE* low = cutBelow(priority, lowFirst);
+        if (!low) {
+            return lower;
+        }
+
+        int lowCount;
+        size_t lowHash = 0;
+        if constexpr (Engine::counted && !ContentHash::enabled) {
+            lowCount = low->weight;
+        } else {
+            // Walk both parts in step until one runs out; its hash is then complete
+            NODE* lowNode = lowFirst;
+            NODE* highNode = first;
+            size_t highHash = 0;
+            int steps = 0;
+            while (lowNode && highNode) {
+                lowHash += elementHash(lowNode);
+                highHash += elementHash(highNode);
+                lowNode = nextNode(lowNode);
+                highNode = nextNode(highNode);
+                steps++;
+            }
+            lowCount = lowNode ? sz - steps : steps;
+            if (lowNode) {
+                lowHash = contentHash - highHash;
+            }
+        }
+
+        lower.root = low;
+        lower.sz = lowCount;
+        lower.first = lowFirst;
+        lower.contentHash = lowHash;
+        sz -= lowCount;
+        contentHash -= lowHash;
+        return lower;
+    }
+
+    // Extract_range: Moves the values with priorities in [lo, hi) to `out` in
+    // queue order and removes them. The range is cut out of the tree and the
+    // part below `lo` joined back on, in O(log n) plus the elements taken.
+    template<typename OutputIt>
+    OutputIt extract_range(const Priority& lo, const Priority& hi, OutputIt out) {
+        if (!before(lo, hi)) {
+            return out;
+        }
+        NODE* belowFirst;
+        NODE* below = cutBelow(lo, belowFirst);
+        NODE* rangeFirst;
+        NODE* range = cutBelow(hi, rangeFirst);
+        joinBelow(below, belowFirst);
+
+        NODE* node = rangeFirst;
+        try {
+            for (; node; node = nextNode(node)) {
+                contentHash -= elementHash(node);
+                *out = std::move(node->value);
+                ++out;
+                sz--;
+            }
+        } catch (...) {
+            // The rest of the range is dropped with the nodes already taken
+            sz--;
+            for (node = nextNode(node); node; node = nextNode(node)) {
+                contentHash -= elementHash(node);
+                sz--;
+            }
+            clearTree(range);
+            throw;
+        }
+        clearTree(range);
+        return out;
+    }
+
+    // Stable reference to one queued element, returned by enqueue and emplace.
+    // It stays valid until that element is dequeued or erased.
+    class handle {
+    public:
+        handle() : node(nullptr) {}
+
+        const T& value() const {
+            return node->value;
+        }
+
+        const Priority& priority() const {
+            return node->priority;
+        }
+
+        bool operator==(const handle& other) const {
+            return node == other.node;
+        }
+
+        bool operator!=(const handle& other) const {
+            return node != other.node;
+        }
+
+    private:
+        friend class prqueue;
+
+        explicit handle(NODE* node) : node(node) {}
+
+        NODE* node;  // The element's NODE, which never moves while it is queued
+    };
+
+    // Enqueue: Inserts the value into the custom BST in the correct location based on priority
+    handle enqueue(const T& value, const Priority& priority) {
+        return emplace(priority, value);
+    }
+
+    // Enqueue: Same as above, moving the value into the queue
+    handle enqueue(T&& value, const Priority& priority) {
+        return emplace(priority, std::move(value));
+    }
+
+    // Emplace: Enqueues a value constructed in place from `args`
+    template<typename... Args>
+    handle emplace(const Priority& priority, Args&&... args) {
+        PRQ_STAT(auto started = chrono::steady_clock::now();)
+        // Create a new node holding the priority and a value built from args
+        NODE* newNode = createNode(priority, std::forward<Args>(args)...);
+        insertNode(newNode);
+        sz++;
+        contentHash += elementHash(newNode);
+        PRQ_STAT(prq::queue_stats::addLatency(counters.enqueueLatency, started);)
+        return handle(newNode);
+    }
+
+    // Erase: Removes the element behind `h` from the queue; `h` becomes invalid
+    void erase(handle h) {
+        contentHash -= elementHash(h.node);
+        unlinkNode(h.node);
+        destroyNode(h.node);
+        sz--;
+    }
+
+    // Update_priority: Moves the element behind `h` to `priority`. It goes to
+    // the back of the elements that already have that priority; `h` stays valid.
+    void update_priority(handle h, const Priority& priority) {
+        NODE* node = h.node;
+        if (samePriority(node->priority, priority)) {
+            return;
+        }
+
+        unlinkNode(node);
+        contentHash -= elementHash(node);
+        node->priority = priority;
+        contentHash += elementHash(node);
+        node->dup = false;
+        node->red = true;
+        node->weight = 1;
+        node->parent = nullptr;
+        node->link = nullptr;
+        node->left = nullptr;
+        node->right = nullptr;
+        insertNode(node);
+    }
+
+    // Dequeue: Returns the value of the next element in the priority queue and removes it
+    T dequeue() {
+        if (!root) {
+            throw runtime_error("prqueue: dequeue from an empty queue");
+        }
+
+        PRQ_STAT(auto started = chrono::steady_clock::now();)
+        // The lowest priority node is cached, so no descent is needed
+        NODE* current = first;
+
+        // Move the value out (it leaves the content hash first), then unlink and free the node
+        contentHash -= elementHash(current);
+        T value = std::move(current->value);
+        detachFirst();
+
+        destroyNode(current);
+
+        // Decrease the size of the priority queue
+        sz--;
+        PRQ_STAT(counters.dequeues++;)
+
+        PRQ_STAT(prq::queue_stats::addLatency(counters.dequeueLatency, started);)
+        return value;
+    }
+
+    // Dequeue_n: Moves up to `k` lowest priority values to `out` in queue order
+    template<typename OutputIt>
+    OutputIt dequeue_n(int k, OutputIt out) {
+        return drain([&k](const T&, const Priority&) { return k-- > 0; }, out);
+    }
+
+    // Dequeue_while: Moves values to `out` in queue order while pred(value, priority) holds
+    template<typename Pred, typename OutputIt>
+    OutputIt dequeue_while(Pred pred, OutputIt out) {
+        return drain(pred, out);
+    }
+
+    // Size: Returns the number of elements in the priority queue
+    int size() {
+        return sz;
+    }
+
+    // Bidirectional iterator over the elements in queue order. It only reads
+    // the tree, so any number of iterators can be in use at once.
+    class const_iterator {
+    public:
+        using iterator_category = bidirectional_iterator_tag;
+        using value_type = entry;
+        using difference_type = ptrdiff_t;
+        using pointer = const entry*;
+        using reference = const entry&;
+
+        const_iterator() : node(nullptr), owner(nullptr) {}
+
+        reference operator*() const {
+            return *node;
+        }
+
+        pointer operator->() const {
+            return node;
+        }
+
+        const_iterator& operator++() {
+            node = nextNode(node);
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        // Stepping back from end() starts at the last element
+        const_iterator& operator--() {
+            if (node) {
+                node = prevNode(node);
+            } else {
+                NODE* last = owner->root;
+                while (last && last->right) {
+                    last = last->right;
+                }
+                node = lastInChain(last);
+            }
+            return *this;
+        }
+
+        const_iterator operator--(int) {
+            const_iterator old = *this;
+            --*this;
+            return old;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return node == other.node;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return node != other.node;
+        }
+
+    private:
+        friend class prqueue;
+
+        const_iterator(NODE* node, const prqueue* owner) : node(node), owner(owner) {}
+
+        NODE* node;            // Current element, nullptr at end()
+        const prqueue* owner;  // Queue being walked, needed to step back from end()
+    };
+
+    using iterator = const_iterator;
+
+    // Begin: Returns an iterator to the lowest priority element. Also resets
+    // the internal state used by next() (iterate a const queue or use cbegin()
+    // to leave that state alone when several threads read at once).
+    const_iterator begin() {
+        // Start the traversal at the leftmost (smallest priority) node
+        curr = first;
+        return const_iterator(first, this);
+    }
+
+    const_iterator begin() const {
+        return cbegin();
+    }
+
+    const_iterator cbegin() const {
+        return const_iterator(first, this);
+    }
+
+    // End: Returns the iterator one past the highest priority element
+    const_iterator end() const {
+        return cend();
+    }
+
+    const_iterator cend() const {
+        return const_iterator(nullptr, this);
+    }
+
+    // Lower_bound: Returns an iterator to the first element whose priority
+    // does not come before `priority`, or end() if there is none, in O(log n)
+    const_iterator lower_bound(const Priority& priority) const {
+        NODE* found = nullptr;
+        for (NODE* node = root; node;) {
+            if (before(node->priority, priority)) {
+                node = node->right;
+            } else {
+                found = node;
+                node = node->left;
+            }
+        }
+        return const_iterator(found, this);
+    }
+
+    // Upper_bound: Returns an iterator to the first element whose priority
+    // comes after `priority` (the next priority up), or end(), in O(log n)
+    const_iterator upper_bound(const Priority& priority) const {
+        NODE* found = nullptr;
+        for (NODE* node = root; node;) {
+            if (before(priority, node->priority)) {
+                found = node;
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+        return const_iterator(found, this);
+    }
+
+    // Count: Returns the number of elements with exactly `priority`. The
+    // tree lookup is O(log n); the duplicate chain is then walked, except
+    // under prq::ranked, which keeps its length.
+    int count(const Priority& priority) const {
+        NODE* head = findHead(priority);
+        if (!head) {
+            return 0;
+        }
+        if constexpr (Engine::counted) {
+            return chainWeight(head);
+        } else {
+            return chainLength(head);
+        }
+    }
+
+    // Contains: Tells whether any element has `priority`, in O(log n)
+    bool contains(const Priority& priority) const {
+        return findHead(priority) != nullptr;
+    }
+
+    // Rank: Returns the number of elements whose priority comes before
+    // `priority` (add count() for "at `priority` or better"). prq::ranked
+    // answers in O(log n) from its counts; the other engines walk the
+    // elements from the front, in O(rank).
+    int rank(const Priority& priority) const {
+        int result = 0;
+        if constexpr (Engine::counted) {
+            for (NODE* node = root; node;) {
+                if (before(node->priority, priority)) {
+                    result += node->weight - weightOf(node->right);
+                    node = node->right;
+                } else {
+                    node = node->left;
+                }
+            }
+        } else {
+            for (NODE* head = first; head && before(head->priority, priority); head = nextHead(head)) {
+                result += chainLength(head);
+            }
+        }
+        return result;
+    }
+
+    // Next: Uses the internal state to return the next inorder priority
+bool next(T& value, Priority& priority) {
+    if (curr == nullptr) {
+        return false; // Internal state has reached null, indicating the end of traversal
+    }
+
+    value = curr->value;
+    priority = curr->priority;
+    PRQ_STAT(counters.nexts++;)
+    PRQ_STAT(counters.nextVisits++;)
+    // Check for duplicates and move to the next linked list node
+    if (curr->link) {
+        curr = curr->link; // Move to the next node in the linked list of duplicates
+
+    } else if (curr->right != nullptr){
+        // If there's a right subtree, go to the right child
+        curr = curr->right;
+        while (curr->left != nullptr) {
+            PRQ_STAT(counters.nextVisits++;)
+            curr = curr->left;
+        }
+    } else{
+
+    
+    while (curr->dup == true){
+        PRQ_STAT(counters.nextVisits++;)
+        curr = curr->parent;
+    }
+    // Find the next inorder node (successor) in the BST
+    if (curr->right != nullptr) {
+        // If there's a right subtree, go to the right child
+        curr = curr->right;
+        while (curr->left != nullptr) {
+            PRQ_STAT(counters.nextVisits++;)
+            curr = curr->left;
+        }
+    } else {
+        // If there's no right subtree, move up to the parent until we reach a node that hasn't been traversed
+
+        while ( curr->parent != nullptr && before(curr->parent->priority, priority)) {
+            PRQ_STAT(counters.nextVisits++;)
+            curr = curr->parent;
+        }
+        curr = curr->parent;
+    }
+
+    // Retrieve the value and priority from the current node
+
+
+    }
+    if (curr == nullptr){
+        return false;
+    }
+
+    return  true; // Return true, indicating that a value and priority were successfully returned
+}
+
+
+    // toString: Returns a string representation of the entire priority queue
+string toString() const {
+    prq::text_writer output;  // Collects the lines in one reserved string
+    _toStringInorder(output);  // Walk the elements in queue order
+    return output.take();
+}
+
+    // write_to: Streams the toString text to `out` in buffered chunks
+    // without building the whole string first
+    void write_to(ostream& out) const {
+        prq::text_writer output(&out);
+        _toStringInorder(output);
+        output.flush();
+    }
+
+    // Save: Writes a binary snapshot of (priority, value) pairs in queue order,
+    // the values going through prq::serializer<T>
+    void save(const string& path) const {
+        prq::snapshot_writer<T, Priority> output(path, size_t(sz));
+        for (NODE* node = first; node; node = nextHead(node)) {
+            for (NODE* current = node; current; current = current->link) {
+                output.add(current->priority, current->value);
+            }
+        }
+        output.finish();
+    }
+
+    // Load: Replaces the contents with a snapshot written by save(). The file
+    // is memory-mapped and its records, already in queue order, go straight
+    // into assign(), which skips the sort and builds the tree in one linear
+    // pass. Throws runtime_error on a missing, foreign or truncated file and
+    // then leaves the queue as it was.
+    void load(const string& path) {
+        prq::snapshot_reader<T, Priority> file(path);
+        prqueue loaded(comp);
+        loaded.assign(file.begin(), file.end());
+        swap(loaded);
+    }
+
+
+    // Peek: Returns the value of the next element in the priority queue without removing it
+    const T& peek() const {
+        if (!root) {
+            throw runtime_error("prqueue: peek at an empty queue");
+        }
+
+        // The leftmost (lowest priority) node is kept up to date by enqueue and dequeue
+        return first->value;
+    }
+
+    // PeekPriority: Returns the priority of the next element without removing it
+    const Priority& peekPriority() const {
+        if (!root) {
+            throw runtime_error("prqueue: peek at an empty queue");
+        }
+        return first->priority;
+    }
+
+    // Equality operator: True when both queues hold the same (priority, value)
+    // elements in the same queue order, however their trees are shaped.
+    // Different sizes or content hashes answer in O(1); otherwise both queues
+    // are walked in lockstep up to the first difference.
+    bool operator==(const prqueue& other) const {
+        if (sz != other.sz || contentHash != other.contentHash) {
+            return false;
+        }
+
+        for (NODE *mine = first, *theirs = other.first; mine; mine = nextNode(mine), theirs = nextNode(theirs)) {
+            if (!samePriority(mine->priority, theirs->priority) || mine->value != theirs->value) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Hash_code: Hash of the contents that agrees with operator==, kept up to
+    // date by every change to the queue so it costs O(1). std::hash<prqueue>
+    // calls it; T needs a std::hash of its own.
+    size_t hash_code() const {
+        static_assert(ContentHash::enabled, "prqueue: hash_code needs std::hash of the value type");
+        return ContentHash::finish(contentHash, size_t(sz));
+    }
+
+#if PRQUEUE_STATS
+    // Stats: The work counters together with the current tree height and
+    // duplicate chain lengths. Measuring the shape walks the whole tree.
+    prq::queue_stats stats() const {
+        prq::queue_stats result = counters;
+        vector<pair<const NODE*, int>> pending;  // (tree node, its depth)
+        if (root) {
+            pending.emplace_back(root, 1);
+        }
+        while (!pending.empty()) {
+            auto [node, depth] = pending.back();
+            pending.pop_back();
+            result.height = max(result.height, depth);
+            result.distinct++;
+            result.maxChain = max(result.maxChain, chainLength(node));
+            if (node->left) {
+                pending.emplace_back(node->left, depth + 1);
+            }
+            if (node->right) {
+                pending.emplace_back(node->right, depth + 1);
+            }
+        }
+        result.averageChain = result.distinct ? double(sz) / result.distinct : 0.0;
+        return result;
+    }
+
+    // Reset_stats: Zeroes the work counters
+    void reset_stats() {
+        counters = prq::queue_stats();
+    }
+#endif
+
+    // getRoot - Used for testing the BST, do not edit/change
+    void* getRoot() {
+        return root;
+    }
+};
+
+
+// prqueue engine backed by a contiguous D-ary min-heap. Ties in priority are
+// broken by an insertion sequence number, so equal priorities still leave in
+// FIFO order like the link chains of the tree engines.
+template<typename T, typename Priority, typename Compare, unsigned D, typename Alloc>
+class prqueue<T, Priority, Compare, prq::dary_heap<D>, Alloc> {
+private:
+    struct ENTRY {
+        Priority priority;    // Heap key
+        unsigned long long seq; // Insertion order, breaks priority ties
+        T value;              // Stored data for the priority queue
+
+        template<typename... Args>
+        ENTRY(const Priority& priority, unsigned long long seq, Args&&... args)
+            : priority(priority), seq(seq), value(std::forward<Args>(args)...) {}
+    };
+
+    using EntryAlloc = typename allocator_traits<Alloc>::template rebind_alloc<ENTRY>;
+
+    // Arithmetic priorities under less<> compare with the built-in operators
+    static constexpr bool plainOrder =
+        is_arithmetic<Priority>::value && is_same<Compare, less<Priority>>::value;
+
+    // Helper function for the heap order: lower priority first, then older first
+    bool before(const ENTRY& a, const ENTRY& b) const {
+        if constexpr (plainOrder) {
+            if (a.priority != b.priority) {
+                return a.priority < b.priority;
+            }
+        } else {
+            if (comp(a.priority, b.priority)) {
+                return true;
+            }
+            if (comp(b.priority, a.priority)) {
+                return false;
+            }
+        }
+        return a.seq < b.seq;
+    }
+
+    // Helper function for the queue order of bare priorities
+    bool before(const Priority& a, const Priority& b) const {
+        if constexpr (plainOrder) {
+            return a < b;
+        } else {
+            return comp(a, b);
+        }
+    }
+
+    // Helper function to move the entry at `pos` up until its parent is before it
+    void siftUp(size_t pos) {
+        ENTRY moving = std::move(heap[pos]);
+        while (pos > 0) {
+            size_t parent = (pos - 1) / D;
+            if (!before(moving, heap[parent])) {
+                break;
+            }
+            heap[pos] = std::move(heap[parent]);
+            pos = parent;
+        }
+        heap[pos] = std::move(moving);
+    }
+
+    // Helper function to move the entry at `pos` down below any child that is before it
+    void siftDown(size_t pos) {
+        size_t count = heap.size();
+        ENTRY moving = std::move(heap[pos]);
+        while (true) {
+            size_t child = pos * D + 1;
+            if (child >= count) {
+                break;
+            }
+            // Pick the earliest of the (up to D) children
+            size_t last = child + D < count ? child + D : count;
+            size_t best = child;
+            for (size_t i = child + 1; i < last; i++) {
+                if (before(heap[i], heap[best])) {
+                    best = i;
+                }
+            }
+            if (!before(heap[best], moving)) {
+                break;
+            }
+            heap[pos] = std::move(heap[best]);
+            pos = best;
+        }
+        heap[pos] = std::move(moving);
+    }
+
+    // Helper function to restore the heap order of the whole array bottom-up in O(n)
+    void heapify() {
+        if (heap.size() > 1) {
+            for (size_t pos = (heap.size() - 2) / D + 1; pos-- > 0;) {
+                siftDown(pos);
+            }
+        }
+    }
+
+    // Helper function to move the entries `take` picks out of the heap, in
+    // array order, keeping the rest in place. The heap order needs restoring afterwards.
+    template<typename Pred>
+    vector<ENTRY, EntryAlloc> takeEntries(Pred take) {
+        vector<ENTRY, EntryAlloc> taken;
+        size_t kept = 0;
+        for (size_t pos = 0; pos < heap.size(); pos++) {
+            if (take(heap[pos].priority)) {
+                taken.push_back(std::move(heap[pos]));
+            } else {
+                if (kept != pos) {
+                    heap[kept] = std::move(heap[pos]);
+                }
+                kept++;
+            }
+        }
+        heap.erase(heap.begin() + kept, heap.end());
+        return taken;
+    }
+
+    // Helper function calling visit(priority, value) on every element in queue order
+    template<typename F>
+    void visitInOrder(F visit) const {
+        for (size_t pos : sortedOrder()) {
+            visit(heap[pos].priority, heap[pos].value);
+        }
+    }
+
+    // Helper function listing entry positions in queue order (used for traversal)
+    vector<size_t> sortedOrder() const {
+        vector<size_t> order(heap.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+            return before(heap[a], heap[b]);
+        });
+        return order;
+    }
+
+    vector<ENTRY, EntryAlloc> heap; // Heap-ordered entries, root at index 0
+    unsigned long long seq;         // Sequence number for the next enqueue
+    vector<size_t> order;           // Snapshot of queue order taken by begin()
+    size_t curr;                    // Position in `order` of the next item (used for traversal)
+    Compare comp;                   // Orders the priorities
+
+public:
+    // Default constructor
+    prqueue() : seq(0), curr(0) {}
+
+    // Constructor with a comparator object (for comparators that carry state)
+    explicit prqueue(const Compare& compare) : seq(0), curr(0), comp(compare) {}
+
+    // Copy constructor
+    prqueue(const prqueue& other) : heap(other.heap), seq(other.seq), curr(0), comp(other.comp) {}
+
+    // Move constructor: Takes over the heap array of `other`, leaving it empty
+    prqueue(prqueue&& other) noexcept
+        : heap(std::move(other.heap)), seq(other.seq), curr(0), comp(std::move(other.comp)) {
+        other.clear();
+    }
+
+    // Move assignment: Takes over the heap array of `other`, leaving it empty
+    prqueue& operator=(prqueue&& other) noexcept {
+        if (this != &other) {
+            clear();
+            swap(other);
+        }
+        return *this;
+    }
+
+    // Swap: Exchanges the contents of two queues in O(1)
+    void swap(prqueue& other) noexcept {
+        heap.swap(other.heap);
+        order.swap(other.order);
+        std::swap(seq, other.seq);
+        std::swap(curr, other.curr);
+        std::swap(comp, other.comp);
+    }
+
+    // Range constructor: Builds the queue from (value, priority) pairs, see assign()
+    template<typename InputIt>
+    prqueue(InputIt from, InputIt to) : prqueue() {
+        assign(from, to);
+    }
+
+    // Assign: Replaces the contents with the (value, priority) pairs in [from, to)
+    // and heapifies them bottom-up in O(n)
+    template<typename InputIt>
+    void assign(InputIt from, InputIt to) {
+        clear();
+        for (; from != to; ++from) {
+            auto&& entry = *from;
+            heap.emplace_back(entry.second, seq++, std::forward<decltype(entry)>(entry).first);
+        }
+        heapify();
+    }
+
+    // Assignment operator
+    prqueue& operator=(const prqueue& other) {
+        if (this == &other) {
+            return *this;
+        }
+        heap = other.heap;
+        seq = other.seq;
+        comp = other.comp;
+        order.clear();
+        curr = 0;
+        return *this;
+    }
+
+    // Clear function to free memory associated with the priority queue
+    void clear() {
+        heap.clear();
+        order.clear();
+        curr = 0;
+    }
+
+    // Enqueue: Adds the value at the end of the heap and sifts it up
+    void enqueue(const T& value, const Priority& priority) {
+        emplace(priority, value);
+    }
+
+    // Enqueue: Same as above, moving the value into the queue
+    void enqueue(T&& value, const Priority& priority) {
+        emplace(priority, std::move(value));
+    }
+
+    // Emplace: Enqueues a value constructed in place from `args`
+    template<typename... Args>
+    void emplace(const Priority& priority, Args&&... args) {
+        heap.emplace_back(priority, seq++, std::forward<Args>(args)...);
+        siftUp(heap.size() - 1);
+    }
+
+    // Merge: Moves every element of `other` into this queue, leaving `other`
+    // empty. Their entries are renumbered after ours in the order they
+    // arrived (O(m log m)), so equal priorities keep FIFO order with this
+    // queue's elements first and the counter only grows by m. The values are
+    // moved into this heap array; a small `other` is sifted up entry by
+    // entry, a large one is heapified together with ours in O(n + m).
+    void merge(prqueue&& other) {
+        if (this == &other || other.heap.empty()) {
+            return;
+        }
+
+        size_t mine = heap.size();
+        size_t total = mine + other.heap.size();
+        heap.reserve(total);
+        sort(other.heap.begin(), other.heap.end(),
+             [](const ENTRY& a, const ENTRY& b) { return a.seq < b.seq; });
+        for (ENTRY& entry : other.heap) {
+            entry.seq = seq++;
+            heap.push_back(std::move(entry));
+        }
+        other.clear();
+
+        size_t depth = 1;
+        while ((size_t(1) << depth) < total) {
+            depth++;
+        }
+        if ((total - mine) * depth < total) {
+            for (size_t pos = mine; pos < total; pos++) {
+                siftUp(pos);
+            }
+        } else {
+            heapify();
+        }
+    }
+
+    // Split: Moves every element with a priority before `priority` into a new
+    // queue and returns it. One pass partitions the array, then both heaps
+    // are rebuilt bottom-up, in O(n) overall. Sequence numbers move along, so
+    // FIFO order among equal priorities is kept on both sides.
+    prqueue split(const Priority& priority) {
+        prqueue lower(comp);
+        lower.heap = takeEntries([&](const Priority& p) { return before(p, priority); });
+        lower.seq = seq;
+        lower.heapify();
+        heapify();
+        order.clear();
+        curr = 0;
+        return lower;
+    }
+
+    // Extract_range: Moves the values with priorities in [lo, hi) to `out` in
+    // queue order and removes them. One pass partitions the array; only the
+    // taken entries are sorted, and the rest is heapified again in O(n).
+    template<typename OutputIt>
+    OutputIt extract_range(const Priority& lo, const Priority& hi, OutputIt out) {
+        if (!before(lo, hi)) {
+            return out;
+        }
+        vector<ENTRY, EntryAlloc> taken = takeEntries([&](const Priority& p) {
+            return !before(p, lo) && before(p, hi);
+        });
+        heapify();
+        order.clear();
+        curr = 0;
+
+        sort(taken.begin(), taken.end(), [this](const ENTRY& a, const ENTRY& b) {
+            return before(a, b);
+        });
+        for (ENTRY& entry : taken) {
+            *out = std::move(entry.value);
+            ++out;
+        }
+        return out;
+    }
+
+    // Dequeue: Returns the value of the next element in the priority queue and removes it
+    T dequeue() {
+        if (heap.empty()) {
+            throw runtime_error("prqueue: dequeue from an empty queue");
+        }
+
+        T value = std::move(heap.front().value);
+        heap.front() = std::move(heap.back());
+        heap.pop_back();
+        if (!heap.empty()) {
+            siftDown(0);
+        }
+        return value;
+    }
+
+    // Dequeue_n: Moves up to `k` lowest priority values to `out` in queue order
+    template<typename OutputIt>
+    OutputIt dequeue_n(int k, OutputIt out) {
+        while (k-- > 0 && !heap.empty()) {
+            *out = dequeue();
+            ++out;
+        }
+        return out;
+    }
+
+    // Dequeue_while: Moves values to `out` in queue order while pred(value, priority) holds
+    template<typename Pred, typename OutputIt>
+    OutputIt dequeue_while(Pred pred, OutputIt out) {
+        while (!heap.empty() && pred(static_cast<const T&>(heap.front().value), heap.front().priority)) {
+            *out = dequeue();
+            ++out;
+        }
+        return out;
+    }
+
+    // Size: Returns the number of elements in the priority queue
+    int size() {
+        return int(heap.size());
+    }
+
+    // Count: Returns the number of elements with exactly `priority`. The heap
+    // is not ordered within its levels, so this and rank() scan it in O(n).
+    int count(const Priority& priority) const {
+        int result = 0;
+        for (const ENTRY& entry : heap) {
+            if (!before(entry.priority, priority) && !before(priority, entry.priority)) {
+                result++;
+            }
+        }
+        return result;
+    }
+
+    // Contains: Tells whether any element has `priority`, in O(n)
+    bool contains(const Priority& priority) const {
+        for (const ENTRY& entry : heap) {
+            if (!before(entry.priority, priority) && !before(priority, entry.priority)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Rank: Returns the number of elements whose priority comes before `priority`, in O(n)
+    int rank(const Priority& priority) const {
+        int result = 0;
+        for (const ENTRY& entry : heap) {
+            if (before(entry.priority, priority)) {
+                result++;
+            }
+        }
+        return result;
+    }
+
+    // Begin: Resets internal state for an in-order traversal. The heap has
+    // no in-order links, so this sorts a snapshot of positions (O(n log n)).
+    void begin() {
+        order = sortedOrder();
+        curr = 0;
+    }
+
+    // Next: Uses the internal state to return the next element in queue order.
+    // Like the tree engines, the last element comes back together with false.
+    bool next(T& value, Priority& priority) {
+        if (curr >= order.size()) {
+            return false;
+        }
+
+        const ENTRY& entry = heap[order[curr]];
+        value = entry.value;
+        priority = entry.priority;
+        curr++;
+        return curr < order.size();
+    }
+
+    // toString: Returns a string representation of the entire priority queue
+    string toString() const {
+        prq::text_writer output;
+        output.expect(heap.size());
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.line(priority, value);
+        });
+        return output.take();
+    }
+
+    // write_to: Streams the toString text to `out` in buffered chunks
+    void write_to(ostream& out) const {
+        prq::text_writer output(&out);
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.line(priority, value);
+        });
+        output.flush();
+    }
+
+    // Save: Writes a binary snapshot of the queue for load(), see prq::serializer
+    void save(const string& path) const {
+        prq::snapshot_writer<T, Priority> output(path, heap.size());
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.add(priority, value);
+        });
+        output.finish();
+    }
+
+    // Load: Replaces the contents with a snapshot written by save(). The file
+    // is memory-mapped and decoded straight into assign(). Throws
+    // runtime_error on a missing, foreign or truncated file and then leaves
+    // the queue as it was.
+    void load(const string& path) {
+        prq::snapshot_reader<T, Priority> file(path);
+        prqueue loaded(comp);
+        loaded.assign(file.begin(), file.end());
+        swap(loaded);
+    }
+
+    // Peek: Returns the value of the next element in the priority queue without removing it
+    const T& peek() const {
+        if (heap.empty()) {
+            throw runtime_error("prqueue: peek at an empty queue");
+        }
+        return heap.front().value;
+    }
+
+    // PeekPriority: Returns the priority of the next element without removing it
+    const Priority& peekPriority() const {
+        if (heap.empty()) {
+            throw runtime_error("prqueue: peek at an empty queue");
+        }
+        return heap.front().priority;
+    }
+
+    // Equality operator: Compares the contents of two priority queues in queue order
+    bool operator==(const prqueue& other) const {
+        if (heap.size() != other.heap.size()) {
+            return false;
+        }
+
+        vector<size_t> mine = sortedOrder();
+        vector<size_t> theirs = other.sortedOrder();
+        for (size_t i = 0; i < mine.size(); i++) {
+            const ENTRY& a = heap[mine[i]];
+            const ENTRY& b = other.heap[theirs[i]];
+            if (comp(a.priority, b.priority) || comp(b.priority, a.priority) || a.value != b.value) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Hash_code: Hash of the contents that agrees with operator==. The
+    // terms add up in any order, so the array is summed as it lies, in O(n).
+    // std::hash<prqueue> calls it; T needs a std::hash of its own.
+    size_t hash_code() const {
+        using ContentHash = prq::content_hash<T, Priority, Compare>;
+        static_assert(ContentHash::enabled, "prqueue: hash_code needs std::hash of the value type");
+        size_t sum = 0;
+        for (const ENTRY& entry : heap) {
+            sum += ContentHash::term(entry.priority, entry.value);
+        }
+        return ContentHash::finish(sum, heap.size());
+    }
+
+    // getRoot - Returns the top of the heap (nullptr when empty)
+    void* getRoot() {
+        return heap.empty() ? nullptr : &heap.front();
+    }
+};
+
+// prqueue engine for small integer priority ranges: one FIFO bucket per
+// priority level in [0, L) and a two-level bitmap of the non-empty levels.
+// enqueue is O(1), and dequeue finds the next level with count-trailing-zeros
+// on the bitmap instead of comparing priorities. Each bucket is a linked list
+// of NODEs in arrival order, like the link chains of the tree engines.
+// Priorities outside [0, L) throw out_of_range and leave the queue unchanged.
+template<typename T, typename Priority, typename Compare, unsigned L, typename Alloc>
+class prqueue<T, Priority, Compare, prq::buckets<L>, Alloc> {
+    static_assert(is_integral<Priority>::value, "bucket levels are integer priorities");
+    static_assert(is_same<Compare, less<Priority>>::value, "buckets serve the lowest level first");
+
+private:
+    struct NODE {
+        T value;     // Stored data for the priority queue
+        NODE* link;  // Next NODE in the same bucket
+
+        template<typename... Args>
+        NODE(Args&&... args) : value(std::forward<Args>(args)...), link(nullptr) {}
+    };
+
+    struct BUCKET {
+        NODE* head = nullptr;  // Oldest NODE at this level, dequeued first
+        NODE* tail = nullptr;  // Newest NODE at this level, enqueue appends here
+        int count = 0;         // NODEs at this level, so split() need not walk them
+    };
+
+    using NodeAlloc = typename allocator_traits<Alloc>::template rebind_alloc<NODE>;
+    using NodeTraits = allocator_traits<NodeAlloc>;
+
+    static constexpr size_t words = (L + 63) / 64;           // Bitmap words, one bit per level
+    static constexpr size_t summaryWords = (words + 63) / 64; // One bit per non-zero bitmap word
+
+    // Helper function to get a NODE from the allocator, constructing its value from `args`
+    template<typename... Args>
+    NODE* createNode(Args&&... args) {
+        NODE* node = NodeTraits::allocate(alloc, 1);
+        try {
+            NodeTraits::construct(alloc, node, std::forward<Args>(args)...);
+        } catch (...) {
+            NodeTraits::deallocate(alloc, node, 1);
+            throw;
+        }
+        return node;
+    }
+
+    // Helper function to return a NODE to the allocator
+    void destroyNode(NODE* node) {
+        NodeTraits::destroy(alloc, node);
+        NodeTraits::deallocate(alloc, node, 1);
+    }
+
+    // Helper function returning the index of the lowest set bit of a non-zero word
+    static size_t lowestBit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+        return size_t(__builtin_ctzll(word));
+#else
+        size_t bit = 0;
+        while (!(word & 1)) {
+            word >>= 1;
+            bit++;
+        }
+        return bit;
+#endif
+    }
+
+    // Helper function to check that `priority` names a level, throwing otherwise
+    static size_t levelOf(const Priority& priority) {
+        bool inRange;
+        if constexpr (is_signed<Priority>::value) {
+            inRange = priority >= 0 && (unsigned long long)(priority) < L;
+        } else {
+            inRange = (unsigned long long)(priority) < L;
+        }
+        if (!inRange) {
+            throw out_of_range("prqueue: priority outside the bucket range");
+        }
+        return size_t(priority);
+    }
+
+    // Helper function mapping a priority bound onto [0, L]; bounds may lie outside the levels
+    static size_t clampLevel(const Priority& priority) {
+        if constexpr (is_signed<Priority>::value) {
+            if (priority < 0) {
+                return 0;
+            }
+        }
+        return (unsigned long long)(priority) < L ? size_t(priority) : L;
+    }
+
+    // Helper function to mark `level` as non-empty in both bitmap levels
+    void markFilled(size_t level) {
+        size_t word = level / 64;
+        bits[word] |= uint64_t(1) << (level % 64);
+        summary[word / 64] |= uint64_t(1) << (word % 64);
+    }
+
+    // Helper function to mark `level` as empty in both bitmap levels
+    void markEmpty(size_t level) {
+        size_t word = level / 64;
+        bits[word] &= ~(uint64_t(1) << (level % 64));
+        if (!bits[word]) {
+            summary[word / 64] &= ~(uint64_t(1) << (word % 64));
+        }
+    }
+
+    // Helper function calling visit(priority, value) on every element in queue order
+    template<typename F>
+    void visitInOrder(F visit) const {
+        for (size_t level = nextLevel(0); level < L; level = nextLevel(level + 1)) {
+            Priority priority = Priority(level);
+            for (NODE* node = table[level].head; node; node = node->link) {
+                visit(priority, node->value);
+            }
+        }
+    }
+
+    // Helper function returning the lowest non-empty level at or above `from`, or L if none
+    size_t nextLevel(size_t from) const {
+        if (from >= L) {
+            return L;
+        }
+
+        // Rest of the word holding `from`
+        size_t word = from / 64;
+        uint64_t rest = bits[word] & (~uint64_t(0) << (from % 64));
+        if (rest) {
+            return word * 64 + lowestBit(rest);
+        }
+
+        // Next non-empty word, found through the summary
+        word++;
+        for (size_t s = word / 64; s < summaryWords; s++) {
+            uint64_t candidates = summary[s];
+            if (s == word / 64 && word % 64) {
+                candidates &= ~uint64_t(0) << (word % 64);
+            }
+            if (candidates) {
+                size_t found = s * 64 + lowestBit(candidates);
+                return found * 64 + lowestBit(bits[found]);
+            }
+        }
+        return L;
+    }
+
+    vector<BUCKET> table;           // One FIFO per level, empty until the first enqueue
+    uint64_t bits[words];           // Bit set for every non-empty level
+    uint64_t summary[summaryWords]; // Bit set for every non-zero word of `bits`
+    size_t low;                     // Lowest non-empty level, L when empty
+    int sz;                         // Number of elements in the prqueue
+    NODE* curr;                     // Next node of the traversal
+    size_t currLevel;               // Level of `curr`
+    NodeAlloc alloc;                // Allocator for the NODEs
+
+public:
+    // Default constructor. The bucket table is allocated by the first enqueue.
+    prqueue() : bits(), summary(), low(L), sz(0), curr(nullptr), currLevel(L) {}
+
+    // Constructor with a comparator object, accepted for symmetry with the other engines
+    explicit prqueue(const Compare&) : prqueue() {}
+
+    // Copy constructor
+    prqueue(const prqueue& other) : prqueue() {
+        *this = other;
+    }
+
+    // Move constructor: Takes over the buckets of `other`, leaving it empty
+    prqueue(prqueue&& other) noexcept : prqueue() {
+        swap(other);
+    }
+
+    // Move assignment: Frees the current nodes and takes over those of `other`
+    prqueue& operator=(prqueue&& other) noexcept {
+        if (this != &other) {
+            clear();
+            swap(other);
+        }
+        return *this;
+    }
+
+    // Swap: Exchanges the contents of two queues. The bitmaps are swapped word
+    // by word; no bucket or node is touched.
+    void swap(prqueue& other) noexcept {
+        table.swap(other.table);
+        for (size_t i = 0; i < words; i++) {
+            std::swap(bits[i], other.bits[i]);
+        }
+        for (size_t i = 0; i < summaryWords; i++) {
+            std::swap(summary[i], other.summary[i]);
+        }
+        std::swap(low, other.low);
+        std::swap(sz, other.sz);
+        std::swap(curr, other.curr);
+        std::swap(currLevel, other.currLevel);
+        std::swap(alloc, other.alloc);
+    }
+
+    // Range constructor: Builds the queue from (value, priority) pairs, see assign()
+    template<typename InputIt>
+    prqueue(InputIt from, InputIt to) : prqueue() {
+        assign(from, to);
+    }
+
+    // Assign: Replaces the contents with the (value, priority) pairs in [from, to).
+    // Every enqueue is O(1), so no bulk path is needed.
+    template<typename InputIt>
+    void assign(InputIt from, InputIt to) {
+        clear();
+        for (; from != to; ++from) {
+            auto&& entry = *from;
+            emplace(entry.second, std::forward<decltype(entry)>(entry).first);
+        }
+    }
+
+    // Assignment operator
+    prqueue& operator=(const prqueue& other) {
+        if (this == &other) {
+            return *this;
+        }
+        clear();
+        for (size_t level = other.nextLevel(0); level < L; level = other.nextLevel(level + 1)) {
+            for (NODE* node = other.table[level].head; node; node = node->link) {
+                emplace(Priority(level), node->value);
+            }
+        }
+        return *this;
+    }
+
+    // Clear function to free memory associated with the priority queue
+    void clear() {
+        for (size_t level = nextLevel(0); level < L; level = nextLevel(level + 1)) {
+            NODE* node = table[level].head;
+            while (node) {
+                NODE* next = node->link;
+                destroyNode(node);
+                node = next;
+            }
+            table[level] = BUCKET();
+        }
+        fill(bits, bits + words, uint64_t(0));
+        fill(summary, summary + summaryWords, uint64_t(0));
+        low = L;
+        sz = 0;
+        curr = nullptr;
+        currLevel = L;
+    }
+
+    // Destructor
+    ~prqueue() {
+        clear();
+    }
+
+    // Enqueue: Appends the value to the bucket of its priority in O(1)
+    void enqueue(const T& value, const Priority& priority) {
+        emplace(priority, value);
+    }
+
+    // Enqueue: Same as above, moving the value into the queue
+    void enqueue(T&& value, const Priority& priority) {
+        emplace(priority, std::move(value));
+    }
+
+    // Emplace: Enqueues a value constructed in place from `args`
+    template<typename... Args>
+    void emplace(const Priority& priority, Args&&... args) {
+        size_t level = levelOf(priority);
+        if (table.empty()) {
+            table.resize(L);
+        }
+        NODE* node = createNode(std::forward<Args>(args)...);
+
+        BUCKET& bucket = table[level];
+        if (bucket.tail) {
+            bucket.tail->link = node;
+        } else {
+            bucket.head = node;
+            markFilled(level);
+            if (level < low) {
+                low = level;
+            }
+        }
+        bucket.tail = node;
+        bucket.count++;
+        sz++;
+    }
+
+    // Merge: Moves every element of `other` into this queue, leaving `other`
+    // empty. Each of its buckets is spliced behind ours in O(1), so the cost
+    // is O(non-empty levels + L / 64) and no NODE is copied or reallocated.
+    void merge(prqueue&& other) {
+        if (this == &other || other.sz == 0) {
+            return;
+        }
+        if (sz == 0) {
+            swap(other);
+            return;
+        }
+
+        for (size_t level = other.nextLevel(0); level < L; level = other.nextLevel(level + 1)) {
+            BUCKET& mine = table[level];
+            BUCKET& theirs = other.table[level];
+            if (mine.tail) {
+                mine.tail->link = theirs.head;
+            } else {
+                mine.head = theirs.head;
+                markFilled(level);
+            }
+            mine.tail = theirs.tail;
+            mine.count += theirs.count;
+            theirs = BUCKET();
+        }
+        low = min(low, other.low);
+        sz += other.sz;
+
+        fill(other.bits, other.bits + words, uint64_t(0));
+        fill(other.summary, other.summary + summaryWords, uint64_t(0));
+        other.low = L;
+        other.sz = 0;
+        other.curr = nullptr;
+        other.currLevel = L;
+    }
+
+    // Split: Moves every element with a priority below `priority` into a new
+    // queue and returns it. Whole buckets change hands in O(levels), so no
+    // NODE is copied or reallocated.
+    prqueue split(const Priority& priority) {
+        prqueue lower;
+        lower.alloc = alloc;
+        size_t bound = clampLevel(priority);
+        if (low >= bound) {
+            return lower;
+        }
+
+        lower.table.resize(L);
+        for (size_t level = low; level < bound; level = nextLevel(level + 1)) {
+            BUCKET& bucket = table[level];
+            lower.sz += bucket.count;
+            lower.table[level] = bucket;
+            lower.markFilled(level);
+            bucket = BUCKET();
+            markEmpty(level);
+        }
+        lower.low = low;
+        low = nextLevel(bound);
+        sz -= lower.sz;
+        curr = nullptr;
+        currLevel = L;
+        return lower;
+    }
+
+    // Extract_range: Moves the values with priorities in [lo, hi) to `out` in
+    // queue order and removes them, bucket by bucket
+    template<typename OutputIt>
+    OutputIt extract_range(const Priority& lo, const Priority& hi, OutputIt out) {
+        curr = nullptr;
+        currLevel = L;
+        size_t bound = clampLevel(hi);
+        for (size_t level = nextLevel(clampLevel(lo)); level < bound; level = nextLevel(level + 1)) {
+            BUCKET& bucket = table[level];
+            while (bucket.head) {
+                // Unlink the NODE before handing its value out, so an output
+                // iterator that throws leaves the rest of the queue intact
+                NODE* node = bucket.head;
+                bucket.head = node->link;
+                bucket.count--;
+                sz--;
+                if (!bucket.head) {
+                    bucket.tail = nullptr;
+                    markEmpty(level);
+                    if (level == low) {
+                        low = nextLevel(level + 1);
+                    }
+                }
+                try {
+                    *out = std::move(node->value);
+                    ++out;
+                } catch (...) {
+                    destroyNode(node);
+                    throw;
+                }
+                destroyNode(node);
+            }
+        }
+        return out;
+    }
+
+    // Dequeue: Returns the value of the next element in the priority queue and removes it
+    T dequeue() {
+        if (sz == 0) {
+            throw runtime_error("prqueue: dequeue from an empty queue");
+        }
+
+        BUCKET& bucket = table[low];
+        NODE* node = bucket.head;
+        bucket.head = node->link;
+        bucket.count--;
+        if (!bucket.head) {
+            bucket.tail = nullptr;
+            markEmpty(low);
+            low = nextLevel(low + 1);
+        }
+        sz--;
+
+        T value = std::move(node->value);
+        destroyNode(node);
+        return value;
+    }
+
+    // Dequeue_n: Moves up to `k` lowest priority values to `out` in queue order
+    template<typename OutputIt>
+    OutputIt dequeue_n(int k, OutputIt out) {
+        while (k-- > 0 && sz > 0) {
+            *out = dequeue();
+            ++out;
+        }
+        return out;
+    }
+
+    // Dequeue_while: Moves values to `out` in queue order while pred(value, priority) holds
+    template<typename Pred, typename OutputIt>
+    OutputIt dequeue_while(Pred pred, OutputIt out) {
+        while (sz > 0 && pred(static_cast<const T&>(table[low].head->value), Priority(low))) {
+            *out = dequeue();
+            ++out;
+        }
+        return out;
+    }
+
+    // Size: Returns the number of elements in the priority queue
+    int size() {
+        return sz;
+    }
+
+    // Count: Returns the number of elements with exactly `priority` in O(1)
+    // (0 outside the levels)
+    int count(const Priority& priority) const {
+        size_t level = clampLevel(priority);
+        if (level >= L || table.empty() || Priority(level) != priority) {
+            return 0;
+        }
+        return table[level].count;
+    }
+
+    // Contains: Tells whether any element has `priority`, in O(1)
+    bool contains(const Priority& priority) const {
+        return count(priority) > 0;
+    }
+
+    // Rank: Returns the number of elements whose priority is below `priority`,
+    // adding up the bucket counts below it in O(levels)
+    int rank(const Priority& priority) const {
+        size_t bound = clampLevel(priority);
+        int result = 0;
+        for (size_t level = low; level < bound; level++) {
+            result += table[level].count;
+        }
+        return result;
+    }
+
+    // Begin: Resets internal state for an in-order traversal
+    void begin() {
+        currLevel = low;
+        curr = low < L ? table[low].head : nullptr;
+    }
+
+    // Next: Uses the internal state to return the next element in queue order.
+    // Like the tree engines, the last element comes back together with false.
+    bool next(T& value, Priority& priority) {
+        if (!curr) {
+            return false;
+        }
+
+        value = curr->value;
+        priority = Priority(currLevel);
+        curr = curr->link;
+        if (!curr) {
+            currLevel = nextLevel(currLevel + 1);
+            curr = currLevel < L ? table[currLevel].head : nullptr;
+        }
+        return curr != nullptr;
+    }
+
+    // toString: Returns a string representation of the entire priority queue
+    string toString() const {
+        prq::text_writer output;
+        output.expect(size_t(sz));
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.line(priority, value);
+        });
+        return output.take();
+    }
+
+    // write_to: Streams the toString text to `out` in buffered chunks
+    void write_to(ostream& out) const {
+        prq::text_writer output(&out);
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.line(priority, value);
+        });
+        output.flush();
+    }
+
+    // Save: Writes a binary snapshot of the queue for load(), see prq::serializer
+    void save(const string& path) const {
+        prq::snapshot_writer<T, Priority> output(path, size_t(sz));
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.add(priority, value);
+        });
+        output.finish();
+    }
+
+    // Load: Replaces the contents with a snapshot written by save(). The file
+    // is memory-mapped and decoded straight into assign(). Throws
+    // runtime_error on a missing, foreign or truncated file and then leaves
+    // the queue as it was.
+    void load(const string& path) {
+        prq::snapshot_reader<T, Priority> file(path);
+        prqueue loaded;
+        loaded.assign(file.begin(), file.end());
+        swap(loaded);
+    }
+
+    // Peek: Returns the value of the next element in the priority queue without removing it
+    const T& peek() const {
+        if (sz == 0) {
+            throw runtime_error("prqueue: peek at an empty queue");
+        }
+        return table[low].head->value;
+    }
+
+    // PeekPriority: Returns the priority of the next element without removing it
+    Priority peekPriority() const {
+        if (sz == 0) {
+            throw runtime_error("prqueue: peek at an empty queue");
+        }
+        return Priority(low);
+    }
+
+    // Equality operator: Compares the contents of two priority queues in queue order
+    bool operator==(const prqueue& other) const {
+        if (sz != other.sz) {
+            return false;
+        }
+        for (size_t level = nextLevel(0); level < L; level = nextLevel(level + 1)) {
+            const NODE* mine = table[level].head;
+            const NODE* theirs = other.table[level].head;
+            while (mine && theirs) {
+                if (mine->value != theirs->value) {
+                    return false;
+                }
+                mine = mine->link;
+                theirs = theirs->link;
+            }
+            if (mine || theirs) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Hash_code: Hash of the contents that agrees with operator==, in one
+    // O(n) pass. std::hash<prqueue> calls it; T needs a std::hash of its own.
+    size_t hash_code() const {
+        using ContentHash = prq::content_hash<T, Priority, Compare>;
+        static_assert(ContentHash::enabled, "prqueue: hash_code needs std::hash of the value type");
+        size_t sum = 0;
+        visitInOrder([&sum](const Priority& priority, const T& value) {
+            sum += ContentHash::term(priority, value);
+        });
+        return ContentHash::finish(sum, size_t(sz));
+    }
+
+    // getRoot - Returns the oldest node of the lowest bucket (nullptr when empty)
+    void* getRoot() {
+        return sz == 0 ? nullptr : table[low].head;
+    }
+};
+
+// prqueue engine with the red-black tree of prq::red_black split into hot
+// keys and cold payloads. The tree is an array of small KEYs (priority plus
+// 32-bit parent/child/chain indices) and the values live in a parallel array
+// at the same index, so a descent only touches priorities and indices. The
+// red and dup flags are folded into the top bits of the parent index. Freed
+// slots are kept on a free list and reused by the next enqueue.
+template<typename T, typename Priority, typename Compare, typename Alloc>
+class prqueue<T, Priority, Compare, prq::compact, Alloc> {
+private:
+    static constexpr uint32_t RED = uint32_t(1) << 31;  // Node is red
+    static constexpr uint32_t DUP = uint32_t(1) << 30;  // Node sits in a duplicate chain
+    static constexpr uint32_t NIL = DUP - 1;            // No node; also masks the index bits
+    static constexpr uint32_t FREE = RED | DUP;         // Slot is on the free list (never a live node)
+
+    struct KEY {
+        Priority priority;  // Used to build the Binary Search Tree (BST)
+        uint32_t up;        // Parent index (previous node for duplicates) with RED and DUP
+        uint32_t left;      // Index of the left child; in a chain's first duplicate, the chain's last node
+        uint32_t right;     // Index of the right child
+        uint32_t link;      // Index of the next node with the same priority
+    };
+
+    using KeyAlloc = typename allocator_traits<Alloc>::template rebind_alloc<KEY>;
+    using ValueTraits = allocator_traits<Alloc>;
+
+    // Arithmetic priorities under less<> compare with the built-in operators
+    static constexpr bool plainOrder =
+        is_arithmetic<Priority>::value && is_same<Compare, less<Priority>>::value;
+
+    // Helper function for the queue order: true when priority `a` comes before `b`
+    bool before(const Priority& a, const Priority& b) const {
+        return comp(a, b);
+    }
+
+    // Helper function telling whether two priorities are equal under the comparator
+    bool samePriority(const Priority& a, const Priority& b) const {
+        if constexpr (plainOrder) {
+            return a == b;
+        } else {
+            return !comp(a, b) && !comp(b, a);
+        }
+    }
+
+    // Helper functions reading and writing the bits packed into KEY::up
+    uint32_t parentOf(uint32_t node) const {
+        return keys[node].up & NIL;
+    }
+
+    void setParent(uint32_t node, uint32_t parent) {
+        keys[node].up = (keys[node].up & ~NIL) | parent;
+    }
+
+    bool isRed(uint32_t node) const {
+        return node != NIL && (keys[node].up & RED);
+    }
+
+    void setRed(uint32_t node, bool red) {
+        if (node != NIL) {
+            keys[node].up = red ? (keys[node].up | RED) : (keys[node].up & ~RED);
+        }
+    }
+
+    // Helper function pointing the parent of `old` (or the root) at `now`
+    void replaceChild(uint32_t parent, uint32_t old, uint32_t now) {
+        if (parent == NIL) {
+            root = now;
+        } else if (keys[parent].left == old) {
+            keys[parent].left = now;
+        } else {
+            keys[parent].right = now;
+        }
+    }
+
+    // Helper function to rotate the subtree at `node` to the left
+    void rotateLeft(uint32_t node) {
+        uint32_t child = keys[node].right;
+        keys[node].right = keys[child].left;
+        if (keys[child].left != NIL) {
+            setParent(keys[child].left, node);
+        }
+        uint32_t parent = parentOf(node);
+        setParent(child, parent);
+        replaceChild(parent, node, child);
+        keys[child].left = node;
+        setParent(node, child);
+    }
+
+    // Helper function to rotate the subtree at `node` to the right
+    void rotateRight(uint32_t node) {
+        uint32_t child = keys[node].left;
+        keys[node].left = keys[child].right;
+        if (keys[child].right != NIL) {
+            setParent(keys[child].right, node);
+        }
+        uint32_t parent = parentOf(node);
+        setParent(child, parent);
+        replaceChild(parent, node, child);
+        keys[child].right = node;
+        setParent(node, child);
+    }
+
+    // Helper function to restore the red-black rules after inserting the red `node`
+    void insertFixup(uint32_t node) {
+        while (isRed(parentOf(node))) {
+            uint32_t parent = parentOf(node);
+            uint32_t grand = parentOf(parent);
+            if (parent == keys[grand].left) {
+                uint32_t uncle = keys[grand].right;
+                if (isRed(uncle)) {
+                    setRed(parent, false);
+                    setRed(uncle, false);
+                    setRed(grand, true);
+                    node = grand;
+                    continue;
+                }
+                if (node == keys[parent].right) {
+                    node = parent;
+                    rotateLeft(node);
+                    parent = parentOf(node);
+                }
+                setRed(parent, false);
+                setRed(grand, true);
+                rotateRight(grand);
+            } else {
+                uint32_t uncle = keys[grand].left;
+                if (isRed(uncle)) {
+                    setRed(parent, false);
+                    setRed(uncle, false);
+                    setRed(grand, true);
+                    node = grand;
+                    continue;
+                }
+                if (node == keys[parent].left) {
+                    node = parent;
+                    rotateRight(node);
+                    parent = parentOf(node);
+                }
+                setRed(parent, false);
+                setRed(grand, true);
+                rotateLeft(grand);
+            }
+        }
+        setRed(root, false);
+    }
+
+    // Helper function to restore the red-black rules after a black node was
+    // removed above `node` (which may be NIL) under `parent`
+    void eraseFixup(uint32_t node, uint32_t parent) {
+        while (node != root && !isRed(node)) {
+            if (node == keys[parent].left) {
+                uint32_t sibling = keys[parent].right;
+                if (isRed(sibling)) {
+                    setRed(sibling, false);
+                    setRed(parent, true);
+                    rotateLeft(parent);
+                    sibling = keys[parent].right;
+                }
+                if (!isRed(keys[sibling].left) && !isRed(keys[sibling].right)) {
+                    setRed(sibling, true);
+                    node = parent;
+                    parent = parentOf(node);
+                    continue;
+                }
+                if (!isRed(keys[sibling].right)) {
+                    setRed(keys[sibling].left, false);
+                    setRed(sibling, true);
+                    rotateRight(sibling);
+                    sibling = keys[parent].right;
+                }
+                setRed(sibling, isRed(parent));
+                setRed(parent, false);
+                setRed(keys[sibling].right, false);
+                rotateLeft(parent);
+            } else {
+                uint32_t sibling = keys[parent].left;
+                if (isRed(sibling)) {
+                    setRed(sibling, false);
+                    setRed(parent, true);
+                    rotateRight(parent);
+                    sibling = keys[parent].left;
+                }
+                if (!isRed(keys[sibling].left) && !isRed(keys[sibling].right)) {
+                    setRed(sibling, true);
+                    node = parent;
+                    parent = parentOf(node);
+                    continue;
+                }
+                if (!isRed(keys[sibling].left)) {
+                    setRed(keys[sibling].right, false);
+                    setRed(sibling, true);
+                    rotateLeft(sibling);
+                    sibling = keys[parent].left;
+                }
+                setRed(sibling, isRed(parent));
+                setRed(parent, false);
+                setRed(keys[sibling].left, false);
+                rotateRight(parent);
+            }
+            node = root;
+        }
+        setRed(node, false);
+    }
+
+    // Helper function returning the tree node after chain head `head` in queue order
+    uint32_t nextHead(uint32_t head) const {
+        if (keys[head].right != NIL) {
+            head = keys[head].right;
+            while (keys[head].left != NIL) {
+                head = keys[head].left;
+            }
+            return head;
+        }
+        uint32_t parent = parentOf(head);
+        while (parent != NIL && keys[parent].right == head) {
+            head = parent;
+            parent = parentOf(head);
+        }
+        return parent;
+    }
+
+    // Helper function to find the tree node holding `priority` (NIL if none)
+    uint32_t findHead(const Priority& priority) const {
+        uint32_t node = root;
+        while (node != NIL) {
+            if (before(priority, keys[node].priority)) {
+                node = keys[node].left;
+            } else if (before(keys[node].priority, priority)) {
+                node = keys[node].right;
+            } else {
+                return node;
+            }
+        }
+        return NIL;
+    }
+
+    // Helper function calling visit(priority, value) on every element in queue order
+    template<typename F>
+    void visitInOrder(F visit) const {
+        uint32_t head = first;
+        for (uint32_t node = first; node != NIL; advance(head, node)) {
+            visit(keys[node].priority, values[node]);
+        }
+    }
+
+    // Helper function stepping (head, node) to the next element in queue order
+    void advance(uint32_t& head, uint32_t& node) const {
+        if (keys[node].link != NIL) {
+            node = keys[node].link;
+        } else {
+            head = nextHead(head);
+            node = head;
+        }
+    }
+
+    // Helper function to unlink `first` from the tree, promoting its next duplicate
+    void detachFirst() {
+        uint32_t node = first;
+        uint32_t parent = parentOf(node);
+
+        if (keys[node].link != NIL) {
+            // The next duplicate takes over the tree position and colour
+            uint32_t promoted = keys[node].link;
+            uint32_t tail = keys[promoted].left;
+            keys[promoted].up = parent | (keys[node].up & RED);
+            keys[promoted].left = NIL;
+            if (keys[promoted].link != NIL) {
+                keys[keys[promoted].link].left = tail;  // The next duplicate now keeps the tail
+            }
+            keys[promoted].right = keys[node].right;
+            if (keys[promoted].right != NIL) {
+                setParent(keys[promoted].right, promoted);
+            }
+            replaceChild(parent, node, promoted);
+            first = promoted;
+            return;
+        }
+
+        // The lowest node has no left child, so its right child takes its place
+        uint32_t child = keys[node].right;
+        replaceChild(parent, node, child);
+        if (child != NIL) {
+            setParent(child, parent);
+            first = child;
+            while (keys[first].left != NIL) {
+                first = keys[first].left;
+            }
+        } else {
+            first = parent;
+        }
+        if (!isRed(node)) {
+            eraseFixup(child, parent);
+        }
+    }
+
+    // Helper function to unlink the tree node `node` from the tree; its
+    // duplicate chain must be gone already. `first` is left to the caller.
+    void unlinkHead(uint32_t node) {
+        uint32_t child;
+        uint32_t parent;
+        bool removedRed;
+        if (keys[node].left == NIL || keys[node].right == NIL) {
+            // At most one child, which moves up into its place
+            child = keys[node].left != NIL ? keys[node].left : keys[node].right;
+            parent = parentOf(node);
+            replaceChild(parent, node, child);
+            if (child != NIL) {
+                setParent(child, parent);
+            }
+            removedRed = isRed(node);
+        } else {
+            // The in-order successor takes over the position and colour
+            uint32_t next = keys[node].right;
+            while (keys[next].left != NIL) {
+                next = keys[next].left;
+            }
+            removedRed = isRed(next);
+            child = keys[next].right;
+            if (parentOf(next) == node) {
+                parent = next;
+            } else {
+                parent = parentOf(next);
+                keys[parent].left = child;
+                if (child != NIL) {
+                    setParent(child, parent);
+                }
+                keys[next].right = keys[node].right;
+                setParent(keys[next].right, next);
+            }
+            keys[next].left = keys[node].left;
+            setParent(keys[next].left, next);
+            replaceChild(parentOf(node), node, next);
+            keys[next].up = keys[node].up;
+        }
+        if (!removedRed) {
+            eraseFixup(child, parent);
+        }
+    }
+
+    // Helper function to destroy the value in `slot` and put the slot on the free list
+    void freeSlot(uint32_t slot) {
+        ValueTraits::destroy(alloc, values + slot);
+        keys[slot].up = FREE;
+        keys[slot].link = freeSlots;
+        freeSlots = slot;
+    }
+
+    // Helper function to make room for payload slot `slot`, moving the live
+    // values into a buffer at least twice as large when it is full
+    void reserveValue(size_t slot) {
+        if (slot < capacity) {
+            return;
+        }
+
+        size_t grown = max(max(capacity * 2, slot + 1), size_t(16));
+        T* moved = ValueTraits::allocate(alloc, grown);
+        size_t i = 0;
+        try {
+            for (; i < keys.size(); i++) {
+                if (keys[i].up != FREE) {
+                    ValueTraits::construct(alloc, moved + i, std::move_if_noexcept(values[i]));
+                }
+            }
+        } catch (...) {
+            while (i-- > 0) {
+                if (keys[i].up != FREE) {
+                    ValueTraits::destroy(alloc, moved + i);
+                }
+            }
+            ValueTraits::deallocate(alloc, moved, grown);
+            throw;
+        }
+        releaseValues();
+        values = moved;
+        capacity = grown;
+    }
+
+    // Helper function to destroy the live values and return the payload buffer
+    void releaseValues() {
+        if (!values) {
+            return;
+        }
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i].up != FREE) {
+                ValueTraits::destroy(alloc, values + i);
+            }
+        }
+        ValueTraits::deallocate(alloc, values, capacity);
+        values = nullptr;
+        capacity = 0;
+    }
+
+    vector<KEY, KeyAlloc> keys; // Tree nodes without their payloads, including free slots
+    T* values;                  // values[i] belongs to keys[i], raw storage for free slots
+    size_t capacity;            // Slots in `values`
+    uint32_t freeSlots;         // Free list of slots, chained through KEY::link
+    int sz;                     // Number of elements in the prqueue
+    uint32_t root;              // Index of the root, NIL when empty
+    uint32_t first;             // Index of the lowest priority node, NIL when empty
+    uint32_t curr;              // Next node of the traversal
+    uint32_t currHead;          // Chain head (tree node) of `curr`
+    Alloc alloc;                // Allocator for the payloads
+    Compare comp;               // Orders the priorities
+
+public:
+    // Default constructor
+    prqueue() : values(nullptr), capacity(0), freeSlots(NIL), sz(0),
+                root(NIL), first(NIL), curr(NIL), currHead(NIL) {}
+
+    // Copy constructor
+    prqueue(const prqueue& other) : prqueue() {
+        *this = other;
+    }
+
+    // Move constructor: Takes over both arrays of `other`, leaving it empty
+    prqueue(prqueue&& other) noexcept : prqueue() {
+        swap(other);
+    }
+
+    // Move assignment: Frees the current contents and takes over those of `other`
+    prqueue& operator=(prqueue&& other) noexcept {
+        if (this != &other) {
+            clear();
+            swap(other);
+        }
+        return *this;
+    }
+
+    // Swap: Exchanges the contents of two queues in O(1)
+    void swap(prqueue& other) noexcept {
+        keys.swap(other.keys);
+        std::swap(values, other.values);
+        std::swap(capacity, other.capacity);
+        std::swap(freeSlots, other.freeSlots);
+        std::swap(sz, other.sz);
+        std::swap(root, other.root);
+        std::swap(first, other.first);
+        std::swap(curr, other.curr);
+        std::swap(currHead, other.currHead);
+        std::swap(alloc, other.alloc);
+        std::swap(comp, other.comp);
+    }
+
+    // Constructor with a comparator object (for comparators that carry state)
+    explicit prqueue(const Compare& compare) : prqueue() {
+        comp = compare;
+    }
+
+    // Range constructor: Builds the queue from (value, priority) pairs, see assign()
+    template<typename InputIt>
+    prqueue(InputIt from, InputIt to) : prqueue() {
+        assign(from, to);
+    }
+
+    // Assign: Replaces the contents with the (value, priority) pairs in [from, to)
+    template<typename InputIt>
+    void assign(InputIt from, InputIt to) {
+        clear();
+        for (; from != to; ++from) {
+            auto&& entry = *from;
+            emplace(entry.second, std::forward<decltype(entry)>(entry).first);
+        }
+    }
+
+    // Assignment operator: the links are indices, so the KEYs are copied as they
+    // are and each live value is copied into the same slot
+    prqueue& operator=(const prqueue& other) {
+        if (this == &other) {
+            return *this;
+        }
+
+        clear();
+        if (other.keys.empty()) {
+            comp = other.comp;
+            return *this;
+        }
+        try {
+            keys.reserve(other.keys.size());
+            reserveValue(other.keys.size() - 1);
+            for (size_t i = 0; i < other.keys.size(); i++) {
+                // The slot only turns live once its value has been copied
+                keys.push_back(KEY{other.keys[i].priority, FREE, NIL, NIL, NIL});
+                if (other.keys[i].up != FREE) {
+                    ValueTraits::construct(alloc, values + i, other.values[i]);
+                }
+                keys[i] = other.keys[i];
+            }
+        } catch (...) {
+            clear();
+            throw;
+        }
+        freeSlots = other.freeSlots;
+        sz = other.sz;
+        root = other.root;
+        first = other.first;
+        comp = other.comp;
+        return *this;
+    }
+
+    // Clear function to free memory associated with the priority queue. The
+    // payload buffer is kept for reuse.
+    void clear() {
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i].up != FREE) {
+                ValueTraits::destroy(alloc, values + i);
+            }
+        }
+        keys.clear();
+        freeSlots = NIL;
+        sz = 0;
+        root = NIL;
+        first = NIL;
+        curr = NIL;
+        currHead = NIL;
+    }
+
+    // Destructor
+    ~prqueue() {
+        clear();
+        releaseValues();
+    }
+
+    // Enqueue: Inserts the value as a red leaf (or at the end of its duplicate chain)
+    void enqueue(const T& value, const Priority& priority) {
+        emplace(priority, value);
+    }
+
+    // Enqueue: Same as above, moving the value into the queue
+    void enqueue(T&& value, const Priority& priority) {
+        emplace(priority, std::move(value));
+    }
+
+    // Emplace: Enqueues a value constructed in place from `args`
+    template<typename... Args>
+    void emplace(const Priority& priority, Args&&... args) {
+        uint32_t node = freeSlots;
+        if (node != NIL) {
+            ValueTraits::construct(alloc, values + node, std::forward<Args>(args)...);
+            freeSlots = keys[node].link;
+            keys[node] = KEY{priority, NIL, NIL, NIL, NIL};
+        } else {
+            if (keys.size() >= NIL) {
+                throw length_error("prqueue: compact engine is out of 30-bit indices");
+            }
+            node = uint32_t(keys.size());
+            keys.push_back(KEY{priority, FREE, NIL, NIL, NIL});
+            try {
+                reserveValue(node);
+                ValueTraits::construct(alloc, values + node, std::forward<Args>(args)...);
+            } catch (...) {
+                keys.pop_back();
+                throw;
+            }
+            keys[node].up = NIL;
+        }
+        sz++;
+
+        if (root == NIL) {
+            root = node;
+            first = node;
+            return;
+        }
+
+        // New lowest priority: hang it to the left of `first` without a descent
+        uint32_t parent = NIL;
+        uint32_t present = NIL;
+        if (before(priority, keys[first].priority)) {
+            parent = first;
+        } else {
+            present = root;
+        }
+        while (present != NIL) {
+            parent = present;
+            if (before(priority, keys[present].priority)) {
+                present = keys[present].left;
+            } else if (before(keys[present].priority, priority)) {
+                present = keys[present].right;
+            } else {
+                // Same priority: append to the end of the duplicate chain, whose
+                // first duplicate keeps the tail in its otherwise unused `left`
+                uint32_t firstDup = keys[present].link;
+                uint32_t tail = firstDup == NIL ? present : keys[firstDup].left;
+                keys[tail].link = node;
+                keys[node].up = tail | DUP;
+                keys[firstDup == NIL ? node : firstDup].left = node;
+                return;
+            }
+        }
+
+        keys[node].up = parent | RED;
+        if (before(priority, keys[parent].priority)) {
+            keys[parent].left = node;
+            if (parent == first) {
+                first = node;
+            }
+        } else {
+            keys[parent].right = node;
+        }
+        insertFixup(node);
+    }
+
+    // Merge: Moves every element of `other` into this queue, leaving `other`
+    // empty. Their values move into this queue's arrays in queue order, so
+    // equal priorities keep FIFO order with this queue's elements first.
+    void merge(prqueue&& other) {
+        if (this == &other || other.root == NIL) {
+            return;
+        }
+        if (root == NIL) {
+            swap(other);
+            return;
+        }
+
+        uint32_t head = other.first;
+        for (uint32_t node = other.first; node != NIL; other.advance(head, node)) {
+            emplace(other.keys[node].priority, std::move(other.values[node]));
+        }
+        other.clear();
+    }
+
+    // Split: Moves every element with a priority before `priority` into a new
+    // queue and returns it. The values live in this queue's arrays, so they
+    // are moved over one by one from the front, in O(k log n) for k elements.
+    prqueue split(const Priority& priority) {
+        prqueue lower(comp);
+        while (root != NIL && before(keys[first].priority, priority)) {
+            Priority moving = keys[first].priority;
+            lower.emplace(moving, dequeue());
+        }
+        curr = NIL;
+        currHead = NIL;
+        return lower;
+    }
+
+    // Extract_range: Moves the values with priorities in [lo, hi) to `out` in
+    // queue order and removes them. Each duplicate chain in the range is freed
+    // in one go and its head unlinked once, in O((k + 1) log n) for k chains.
+    template<typename OutputIt>
+    OutputIt extract_range(const Priority& lo, const Priority& hi, OutputIt out) {
+        if (!before(lo, hi)) {
+            return out;
+        }
+
+        // The chain heads in the range, listed first as unlinking rotates the tree
+        uint32_t head = NIL;
+        for (uint32_t node = root; node != NIL;) {
+            if (before(keys[node].priority, lo)) {
+                node = keys[node].right;
+            } else {
+                head = node;
+                node = keys[node].left;
+            }
+        }
+        vector<uint32_t> heads;
+        for (; head != NIL && before(keys[head].priority, hi); head = nextHead(head)) {
+            heads.push_back(head);
+        }
+
+        for (uint32_t taken : heads) {
+            for (uint32_t node = taken; node != NIL; node = keys[node].link) {
+                *out = std::move(values[node]);
+                ++out;
+            }
+            uint32_t dupNode = keys[taken].link;
+            while (dupNode != NIL) {
+                uint32_t next = keys[dupNode].link;
+                freeSlot(dupNode);
+                sz--;
+                dupNode = next;
+            }
+            unlinkHead(taken);
+            freeSlot(taken);
+            sz--;
+        }
+
+        first = root;
+        if (first != NIL) {
+            while (keys[first].left != NIL) {
+                first = keys[first].left;
+            }
+        }
+        curr = NIL;
+        currHead = NIL;
+        return out;
+    }
+
+    // Dequeue: Returns the value of the next element in the priority queue and removes it
+    T dequeue() {
+        if (root == NIL) {
+            throw runtime_error("prqueue: dequeue from an empty queue");
+        }
+
+        uint32_t slot = first;
+        T value = std::move(values[slot]);
+        detachFirst();
+        freeSlot(slot);
+        sz--;
+        return value;
+    }
+
+    // Dequeue_n: Moves up to `k` lowest priority values to `out` in queue order
+    template<typename OutputIt>
+    OutputIt dequeue_n(int k, OutputIt out) {
+        while (k-- > 0 && root != NIL) {
+            *out = dequeue();
+            ++out;
+        }
+        return out;
+    }
+
+    // Dequeue_while: Moves values to `out` in queue order while pred(value, priority) holds
+    template<typename Pred, typename OutputIt>
+    OutputIt dequeue_while(Pred pred, OutputIt out) {
+        while (root != NIL && pred(static_cast<const T&>(values[first]), keys[first].priority)) {
+            *out = dequeue();
+            ++out;
+        }
+        return out;
+    }
+
+    // Size: Returns the number of elements in the priority queue
+    int size() {
+        return sz;
+    }
+
+    // Count: Returns the number of elements with exactly `priority`: an
+    // O(log n) descent, then a walk along its duplicate chain
+    int count(const Priority& priority) const {
+        int result = 0;
+        for (uint32_t node = findHead(priority); node != NIL; node = keys[node].link) {
+            result++;
+        }
+        return result;
+    }
+
+    // Contains: Tells whether any element has `priority`, in O(log n)
+    bool contains(const Priority& priority) const {
+        return findHead(priority) != NIL;
+    }
+
+    // Rank: Returns the number of elements whose priority comes before
+    // `priority`, walking the keys from the front in O(rank)
+    int rank(const Priority& priority) const {
+        int result = 0;
+        uint32_t head = first;
+        for (uint32_t node = first; node != NIL && before(keys[node].priority, priority); advance(head, node)) {
+            result++;
+        }
+        return result;
+    }
+
+    // Begin: Resets internal state for an in-order traversal
+    void begin() {
+        curr = first;
+        currHead = first;
+    }
+
+    // Next: Uses the internal state to return the next element in queue order.
+    // Like the tree engines, the last element comes back together with false.
+    bool next(T& value, Priority& priority) {
+        if (curr == NIL) {
+            return false;
+        }
+
+        value = values[curr];
+        priority = keys[curr].priority;
+        advance(currHead, curr);
+        return curr != NIL;
+    }
+
+    // toString: Returns a string representation of the entire priority queue
+    string toString() const {
+        prq::text_writer output;
+        output.expect(size_t(sz));
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.line(priority, value);
+        });
+        return output.take();
+    }
+
+    // write_to: Streams the toString text to `out` in buffered chunks
+    void write_to(ostream& out) const {
+        prq::text_writer output(&out);
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.line(priority, value);
+        });
+        output.flush();
+    }
+
+    // Save: Writes a binary snapshot of the queue for load(), see prq::serializer
+    void save(const string& path) const {
+        prq::snapshot_writer<T, Priority> output(path, size_t(sz));
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.add(priority, value);
+        });
+        output.finish();
+    }
+
+    // Load: Replaces the contents with a snapshot written by save(). The file
+    // is memory-mapped and decoded straight into assign(). Throws
+    // runtime_error on a missing, foreign or truncated file and then leaves
+    // the queue as it was.
+    void load(const string& path) {
+        prq::snapshot_reader<T, Priority> file(path);
+        prqueue loaded(comp);
+        loaded.assign(file.begin(), file.end());
+        swap(loaded);
+    }
+
+    // Peek: Returns the value of the next element in the priority queue without removing it
+    const T& peek() const {
+        if (root == NIL) {
+            throw runtime_error("prqueue: peek at an empty queue");
+        }
+        return values[first];
+    }
+
+    // PeekPriority: Returns the priority of the next element without removing it
+    const Priority& peekPriority() const {
+        if (root == NIL) {
+            throw runtime_error("prqueue: peek at an empty queue");
+        }
+        return keys[first].priority;
+    }
+
+    // Equality operator: Compares the contents of two priority queues in queue order
+    bool operator==(const prqueue& other) const {
+        if (sz != other.sz) {
+            return false;
+        }
+
+        uint32_t head = first, otherHead = other.first;
+        uint32_t node = first, otherNode = other.first;
+        while (node != NIL) {
+            if (!samePriority(keys[node].priority, other.keys[otherNode].priority) ||
+                values[node] != other.values[otherNode]) {
+                return false;
+            }
+            advance(head, node);
+            other.advance(otherHead, otherNode);
+        }
+        return true;
+    }
+
+    // Hash_code: Hash of the contents that agrees with operator==, in one
+    // O(n) pass. std::hash<prqueue> calls it; T needs a std::hash of its own.
+    size_t hash_code() const {
+        using ContentHash = prq::content_hash<T, Priority, Compare>;
+        static_assert(ContentHash::enabled, "prqueue: hash_code needs std::hash of the value type");
+        size_t sum = 0;
+        visitInOrder([&sum](const Priority& priority, const T& value) {
+            sum += ContentHash::term(priority, value);
+        });
+        return ContentHash::finish(sum, size_t(sz));
+    }
+
+    // getRoot - Returns the KEY at the root of the tree (nullptr when empty)
+    void* getRoot() {
+        return root == NIL ? nullptr : &keys[root];
+    }
+};
+
+// prqueue engine whose copies share their NODEs. The elements sit in a
+// treap ordered by priority, newer elements behind older ones of the same
+// priority, and balanced by a hashed insertion count standing in for the
+// usual random treap keys. Every NODE counts the roots and parents pointing
+// at it: copying a queue takes one more reference to the root in O(1), and
+// a change to either copy clones only the shared NODEs on the path it walks,
+// O(log n) of them. NODEs no other copy can reach are changed in place, so
+// a queue that is never copied pays nothing but the counts. The counts are
+// atomic, so copies can be read, changed and destroyed on different threads;
+// taking the copy must not race with changes to its source. Values are
+// copied out of shared NODEs, so T must be copy constructible, and NODEs
+// are freed by whichever copy lets go of them last, through its allocator.
+template<typename T, typename Priority, typename Compare, typename Alloc>
+class prqueue<T, Priority, Compare, prq::persistent, Alloc> {
+    static_assert(is_copy_constructible<T>::value, "shared NODEs are cloned before they change");
+
+private:
+    struct NODE {
+        Priority priority;  // Orders the treap
+        T value;            // Stored data for the priority queue
+        atomic<int> refs;   // Roots and parent links pointing at this NODE
+        uint32_t heapKey;   // Treap key, never below a child's; keeps the treap balanced
+        int weight;         // Elements in the subtree under this NODE, itself included
+        NODE* left;         // Elements that come before this one
+        NODE* right;        // Elements that come after this one
+
+        template<typename... Args>
+        NODE(const Priority& priority, uint32_t heapKey, Args&&... args)
+            : priority(priority), value(std::forward<Args>(args)...), refs(1), heapKey(heapKey),
+              weight(1), left(nullptr), right(nullptr) {}
+    };
+
+    using NodeAlloc = typename allocator_traits<Alloc>::template rebind_alloc<NODE>;
+    using NodeTraits = allocator_traits<NodeAlloc>;
+
+    // Arithmetic priorities under less<> compare with the built-in operators
+    static constexpr bool plainOrder =
+        is_arithmetic<Priority>::value && is_same<Compare, less<Priority>>::value;
+
+    // Helper function for the queue order: true when priority `a` comes before `b`
+    bool before(const Priority& a, const Priority& b) const {
+        return comp(a, b);
+    }
+
+    // Helper function telling whether two priorities are equal under the comparator
+    bool samePriority(const Priority& a, const Priority& b) const {
+        if constexpr (plainOrder) {
+            return a == b;
+        } else {
+            return !comp(a, b) && !comp(b, a);
+        }
+    }
+
+    // Helper function to get a NODE from the allocator with `heapKey`, constructing its value from `args`
+    template<typename... Args>
+    NODE* createNode(const Priority& priority, uint32_t heapKey, Args&&... args) {
+        NODE* node = NodeTraits::allocate(alloc, 1);
+        try {
+            NodeTraits::construct(alloc, node, priority, heapKey, std::forward<Args>(args)...);
+        } catch (...) {
+            NodeTraits::deallocate(alloc, node, 1);
+            throw;
+        }
+        return node;
+    }
+
+    // Helper function to return a NODE to the allocator
+    void destroyNode(NODE* node) {
+        NodeTraits::destroy(alloc, node);
+        NodeTraits::deallocate(alloc, node, 1);
+    }
+
+    // Helper function drawing the treap key of the next new NODE
+    uint32_t nextKey() {
+        seq += 0x9e3779b97f4a7c15ULL;
+        return uint32_t(prq::mix64(seq) >> 32);
+    }
+
+    // Helper function to get the element count of a subtree (0 for nullptr)
+    static int weightOf(const NODE* node) {
+        return node ? node->weight : 0;
+    }
+
+    // Helper function to recount a NODE from its children
+    static void updateWeight(NODE* node) {
+        node->weight = 1 + weightOf(node->left) + weightOf(node->right);
     }
 
-    // Helper function for converting the prqueue to a string
- void _toStringRecursive(NODE* node, ostream& output) {
+    // Helper function to take one more reference to `node` (passes nullptr through)
+    static NODE* retain(NODE* node) {
         if (node) {
-            _toStringRecursive(node->left, output);
+            node->refs.fetch_add(1, memory_order_relaxed);
+        }
+        return node;
+    }
 
-            // Format and append the node information to the output stream
-            output << node->priority << " value: " << node->value << endl;
-            if (node->link) {
-                // If there are duplicate priorities, traverse the linked list
-                NODE* current = node->link;
-                while (current) {
-                    output << current->priority << " value: " << current->value << endl;
-                    current = current->link;
-                }
-            }
+    // Helper function to drop a reference to `node`. The last one frees it
+    // and drops its references to its children; recursing only to the left
+    // keeps the depth within the treap height.
+    void release(NODE* node) {
+        while (node && node->refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+            release(node->left);
+            NODE* right = node->right;
+            destroyNode(node);
+            node = right;
+        }
+    }
 
-            _toStringRecursive(node->right, output);
+    // Helper function to make the NODE behind `link` safe to change. It is
+    // returned as it is when `link` holds the only reference; otherwise a
+    // clone sharing its children takes its place. Callers walk down from
+    // the root, so a NODE with one reference is reachable from this queue only.
+    NODE* own(NODE*& link) {
+        NODE* node = link;
+        if (node->refs.load(memory_order_acquire) == 1) {
+            return node;
         }
- }
+        return cloneInto(link);
+    }
 
+    // Helper function to put a clone of the shared NODE behind `link` in its place
+    NODE* cloneInto(NODE*& link) {
+        NODE* node = link;
+        NODE* copy = createNode(node->priority, node->heapKey, static_cast<const T&>(node->value));
+        copy->weight = node->weight;
+        copy->left = retain(node->left);
+        copy->right = retain(node->right);
+        link = copy;
+        release(node);
+        return copy;
+    }
 
-    // Helper function to create a deep copy of a BST
-    NODE* copyTree(NODE* otherNode) {
-        if (otherNode == nullptr) {
-            return nullptr;
+    // Helper function to own every NODE on the search path that goesLow
+    // steers (right where it holds, left otherwise). Run before changing
+    // the tree, so a clone that throws leaves the queue as it was.
+    template<typename GoesLow>
+    void ownPath(NODE** link, GoesLow goesLow) {
+        while (*link) {
+            NODE* node = own(*link);
+            link = goesLow(node->priority) ? &node->right : &node->left;
         }
+    }
 
-        NODE* newNode = new NODE;
-        newNode->priority = otherNode->priority;
-        newNode->value = otherNode->value;
-        newNode->dup = otherNode->dup;
-        newNode->parent = nullptr;
-        newNode->link = copyLinkedList(otherNode->link);  // Copy the linked list
-        newNode->left = copyTree(otherNode->left);        // Recursively copy left subtree
-        newNode->right = copyTree(otherNode->right);      // Recursively copy right subtree
-
-        // Update parent pointers (if not null)
-        if (newNode->left) {
-            newNode->left->parent = newNode;
+    // Helper function to split the treap under `node` into the elements for
+    // which goesLow(priority) holds, which must come first, and the rest. The
+    // NODEs on the search path must already be owned (see ownPath). The low
+    // part's right spine and the high part's left spine end up owned too,
+    // so the two can be joined again without cloning.
+    template<typename GoesLow>
+    static void splitOwned(NODE* node, GoesLow& goesLow, NODE*& low, NODE*& high) {
+        if (!node) {
+            low = nullptr;
+            high = nullptr;
+            return;
         }
-        if (newNode->right) {
-            newNode->right->parent = newNode;
+        if (goesLow(node->priority)) {
+            splitOwned(node->right, goesLow, node->right, high);
+            low = node;
+        } else {
+            splitOwned(node->left, goesLow, low, node->left);
+            high = node;
         }
-
-        return newNode;
+        updateWeight(node);
     }
 
-    // Helper function to create a deep copy of a linked list
-    NODE* copyLinkedList(NODE* otherHead) {
-        NODE* newHead = nullptr;
-        NODE* current = nullptr;
+    // Helper function to join two treaps whose elements all come in order,
+    // `low` first. Walks the right spine of `low` and the left spine of
+    // `high`, which must be owned.
+    static NODE* joinOwned(NODE* low, NODE* high) {
+        if (!low || !high) {
+            return low ? low : high;
+        }
+        if (low->heapKey >= high->heapKey) {
+            low->right = joinOwned(low->right, high);
+            updateWeight(low);
+            return low;
+        }
+        high->left = joinOwned(low, high->left);
+        updateWeight(high);
+        return high;
+    }
 
-        while (otherHead) {
-            NODE* newNode = new NODE;
-            newNode->priority = otherHead->priority;
-            newNode->value = otherHead->value;
-            newNode->dup = otherHead->dup;
-            newNode->parent = nullptr;
-            newNode->link = nullptr;
-            newNode->left = nullptr;
-            newNode->right = nullptr;
+    // Helper function to own the right spine of `*link` (toRight) or its left spine
+    void ownSpine(NODE** link, bool toRight) {
+        while (*link) {
+            NODE* node = own(*link);
+            link = toRight ? &node->right : &node->left;
+        }
+    }
 
-            if (current) {
-                current->link = newNode;
-                newNode->parent = current;
-                current = newNode;
+    // Helper function counting the elements whose priority passes goesLow,
+    // which holds for a prefix of the queue, in O(log n)
+    template<typename GoesLow>
+    int countLow(GoesLow goesLow) const {
+        int result = 0;
+        for (const NODE* node = root; node;) {
+            if (goesLow(node->priority)) {
+                result += weightOf(node->left) + 1;
+                node = node->right;
             } else {
-                newHead = newNode;
-                current = newNode;
+                node = node->left;
             }
-
-            otherHead = otherHead->link;
         }
-
-        return newHead;
+        return result;
     }
 
-    // Function to clear the tree and free memory
-    void clearTree(NODE* node) {
-        if (node) {
-            clearTree(node->left);
-            clearTree(node->right);
-          
-            if (node->link) {
-                NODE* current = node->link;
-                while (current) {
-                    NODE* temp = current;
-                    current = current->link;
-                    delete temp;
-                }
+    // Helper function calling take(priority, value) on every element under
+    // `node` in queue order. Values of NODEs that only this queue can reach
+    // (`owned` and one reference) are passed as rvalues to be moved from.
+    template<typename F>
+    static void takeInOrder(NODE* node, bool owned, F& take) {
+        while (node) {
+            owned = owned && node->refs.load(memory_order_acquire) == 1;
+            takeInOrder(node->left, owned, take);
+            if (owned) {
+                take(node->priority, std::move(node->value));
+            } else {
+                take(node->priority, static_cast<const T&>(node->value));
             }
-            
-            delete node;
+            node = node->right;
         }
     }
 
-    // Helper function to compare two BSTs for equality
-    bool areTreesEqual(NODE* node1, NODE* node2) const {
-        if (node1 == nullptr && node2 == nullptr) {
-            return true; // Both trees are empty or have reached the end
+    // Helper function to push `node` and its chain of left children onto an in-order trail
+    static void pushLeft(vector<const NODE*>& trail, const NODE* node) {
+        for (; node; node = node->left) {
+            trail.push_back(node);
         }
-        if (node1 != nullptr && node2 != nullptr) {
-            // Check if priorities and values are equal
-            if (node1->priority == node2->priority && node1->value == node2->value) {
-                // Recursively compare left and right subtrees
-                bool leftSubtreeEqual = areTreesEqual(node1->left, node2->left);
-                bool rightSubtreeEqual = areTreesEqual(node1->right, node2->right);
+    }
 
-                // Check if linked lists are equal
-                bool linkedListsEqual = areLinkedListsEqual(node1->link, node2->link);
+    // Helper function to take the next element in queue order off a trail
+    static const NODE* popNext(vector<const NODE*>& trail) {
+        const NODE* node = trail.back();
+        trail.pop_back();
+        pushLeft(trail, node->right);
+        return node;
+    }
 
-                // Return true only if both subtrees and linked lists are equal
-                return leftSubtreeEqual && rightSubtreeEqual && linkedListsEqual;
-            }
+    // Helper function calling visit(priority, value) on every element in queue order
+    template<typename F>
+    void visitInOrder(F visit) const {
+        vector<const NODE*> pending;
+        pushLeft(pending, root);
+        while (!pending.empty()) {
+            const NODE* node = popNext(pending);
+            visit(node->priority, node->value);
         }
-        // If any of the above conditions doesn't hold, the trees are not equal
-        return false;
     }
 
-    NODE* root; // Pointer to root node of the BST
-    int sz;     // Number of elements in the prqueue
-    NODE* curr; // Pointer to the next item in prqueue (used for traversal)
+    NODE* root;                 // Root of the treap, shared with copies
+    unsigned long long seq;     // Insertion count behind the treap keys
+    vector<const NODE*> trail;  // Traversal state of begin() and next()
+    NodeAlloc alloc;            // Allocator for the NODEs
+    Compare comp;               // Orders the priorities
 
 public:
     // Default constructor
-    prqueue() : root(nullptr), sz(0), curr(nullptr) {
-        // Initialize the private members:
-        // - `root` is set to nullptr, indicating an empty tree.
-        // - `sz` is set to 0, indicating that there are no elements in the priority queue.
-        // - `curr` is set to nullptr, as there's no current item in the queue.
+    prqueue() : root(nullptr), seq(0) {}
+
+    // Constructor with a comparator object (for comparators that carry state)
+    explicit prqueue(const Compare& compare) : prqueue() {
+        comp = compare;
     }
 
-    // Assignment operator
-    prqueue& operator=(const prqueue& other) {
-        // Step 1: Check for self-assignment
-        if (this == &other) {
-            return *this;  // Return the current object if self-assignment
-        }
+    // Copy constructor: Shares the NODEs of `other` in O(1)
+    prqueue(const prqueue& other) : prqueue() {
+        *this = other;
+    }
 
-        // Step 2: Clear the current object
-        clear();
+    // Move constructor: Takes over the NODEs of `other`, leaving it empty
+    prqueue(prqueue&& other) noexcept : prqueue() {
+        swap(other);
+    }
 
-        // Step 3: Make a deep copy of the 'other' priority queue
-        if (other.root) {
-            root = copyTree(other.root); // Create a deep copy of the other tree
+    // Range constructor: Builds the queue from (value, priority) pairs, see assign()
+    template<typename InputIt>
+    prqueue(InputIt from, InputIt to) : prqueue() {
+        assign(from, to);
+    }
+
+    // Assignment operator: Shares the NODEs of `other` in O(1); the first
+    // changes to either queue clone the NODEs they touch
+    prqueue& operator=(const prqueue& other) {
+        if (this != &other) {
+            NODE* shared = retain(other.root);
+            release(root);
+            root = shared;
+            seq = other.seq;
+            trail.clear();
+            comp = other.comp;
         }
-        sz = other.sz;
-        curr = nullptr; // Reset the 'curr' pointer
+        return *this;
+    }
 
+    // Move assignment: Drops the current contents and takes over those of `other`
+    prqueue& operator=(prqueue&& other) noexcept {
+        if (this != &other) {
+            clear();
+            swap(other);
+        }
         return *this;
     }
 
-    // Clear function to free memory associated with the priority queue
+    // Swap: Exchanges the contents of two queues in O(1)
+    void swap(prqueue& other) noexcept {
+        std::swap(root, other.root);
+        std::swap(seq, other.seq);
+        trail.swap(other.trail);
+        std::swap(alloc, other.alloc);
+        std::swap(comp, other.comp);
+    }
+
+    // Clear: Drops this queue's reference to its NODEs, freeing those no copy shares
     void clear() {
-        clearTree(root);
+        release(root);
         root = nullptr;
-        sz = 0;
-        curr = nullptr;
+        trail.clear();
     }
 
-    // Destructor to free the memory associated with the priority queue
+    // Destructor
     ~prqueue() {
         clear();
     }
 
-    // Enqueue: Inserts the value into the custom BST in the correct location based on priority
-void enqueue(T value, int priority){
-   // Create a new node to hold the provided value and priority
-   NODE* newNode = new NODE();
-   newNode->value = value; 
-   newNode->priority = priority; 
-   newNode->dup = false; 
-   newNode->parent = nullptr; 
-   newNode->link = nullptr; 
-   newNode->left = nullptr; 
-   newNode->right = nullptr; 
-
-   // If the tree is empty, set the new node as the root and update the size (sz)
-   if (root == nullptr){
-       root = newNode;
-       sz = 1;
-       return;
-   }
-
-
-
-   // Initialize pointers for traversal
-   NODE* beforeNode = nullptr;
-   NODE* present = root;
-
-   // Traverse the tree to find the appropriate location for the new node
-   while (present){
-
-       beforeNode = present;
-
-       if (priority < present->priority){
-
-           present = present->left;
-       }
-       else if (priority > present->priority){
-
-           present = present->right;
-       } else {
-           // If a node with the same priority is found, mark the new node as a duplicate
-           newNode->dup = true;
-           // Traverse the linked list of nodes with the same priority and add the new node at the end
-           while(present->link) {
-               present = present->link;
-           }
-           present->link = newNode;
-
-           newNode->link = nullptr;
-
-           newNode->parent = present;
-
-           sz++; // Update the size of the priority queue
-           return;
-       }
-   }
-
-   // Insert the new node as the left or right child of the previous node based on priority
-   if (priority < beforeNode->priority) {
-       beforeNode->left = newNode;
-
-   } 
-   else {
-       beforeNode->right = newNode;
-   }
-
-   // Set the parent of the new node
-   newNode->parent = beforeNode;
-   // Update the size of the priority queue
-   sz++;
-}
+    // Assign: Replaces the contents with the (value, priority) pairs in [from, to)
+    template<typename InputIt>
+    void assign(InputIt from, InputIt to) {
+        clear();
+        for (; from != to; ++from) {
+            auto&& entry = *from;
+            emplace(entry.second, std::forward<decltype(entry)>(entry).first);
+        }
+    }
+
+    // Enqueue: Inserts the value behind every element of the same priority
+    void enqueue(const T& value, const Priority& priority) {
+        emplace(priority, value);
+    }
 
+    // Enqueue: Same as above, moving the value into the queue
+    void enqueue(T&& value, const Priority& priority) {
+        emplace(priority, std::move(value));
+    }
 
+    // Emplace: Enqueues a value constructed in place from `args`. The new
+    // NODE goes down the search path until its treap key is the larger one,
+    // and the subtree it lands on is split around it.
+    template<typename... Args>
+    void emplace(const Priority& priority, Args&&... args) {
+        NODE* fresh = createNode(priority, nextKey(), std::forward<Args>(args)...);
+        auto goesLow = [&](const Priority& p) { return !before(priority, p); };
 
-    // Dequeue: Returns the value of the next element in the priority queue and removes it
-    T dequeue() {
+        // One walk owns the path and counts the new element in; a clone
+        // that throws has the counts taken back on the way out
+        NODE** link = &root;
+        int raised = 0;
+        try {
+            while (*link && (*link)->heapKey >= fresh->heapKey) {
+                NODE* node = own(*link);
+                node->weight++;
+                raised++;
+                link = goesLow(node->priority) ? &node->right : &node->left;
+            }
+            ownPath(link, goesLow);
+        } catch (...) {
+            for (NODE* node = root; raised > 0; raised--) {
+                node->weight--;
+                node = goesLow(node->priority) ? node->right : node->left;
+            }
+            destroyNode(fresh);
+            throw;
+        }
+        trail.clear();
+        splitOwned(*link, goesLow, fresh->left, fresh->right);
+        updateWeight(fresh);
+        *link = fresh;
+    }
+
+    // Merge: Moves every element of `other` into this queue, leaving `other`
+    // empty, with this queue's elements first among equal priorities. When
+    // the priorities do not overlap the treaps are joined in O(log n);
+    // otherwise the elements of `other` are enqueued one by one.
+    void merge(prqueue&& other) {
+        if (this == &other || !other.root) {
+            return;
+        }
         if (!root) {
-            return {};
+            swap(other);
+            return;
         }
+        trail.clear();
 
-        NODE* current = root;
-        NODE* parent = nullptr;
+        const NODE* ourLast = root;
+        while (ourLast->right) {
+            ourLast = ourLast->right;
+        }
+        const NODE* theirFirst = other.root;
+        while (theirFirst->left) {
+            theirFirst = theirFirst->left;
+        }
+        if (!before(theirFirst->priority, ourLast->priority)) {
+            ownSpine(&root, true);
+            other.ownSpine(&other.root, false);
+            root = joinOwned(root, other.root);
+            other.root = nullptr;
+            other.trail.clear();
+            return;
+        }
 
-        // Traverse to the leftmost (lowest priority) leaf node
-        while (current->left) {
-            parent = current;
-            current = current->left;
+        const NODE* ourFirst = root;
+        while (ourFirst->left) {
+            ourFirst = ourFirst->left;
+        }
+        const NODE* theirLast = other.root;
+        while (theirLast->right) {
+            theirLast = theirLast->right;
+        }
+        if (before(theirLast->priority, ourFirst->priority)) {
+            other.ownSpine(&other.root, true);
+            ownSpine(&root, false);
+            root = joinOwned(other.root, root);
+            other.root = nullptr;
+            other.trail.clear();
+            return;
         }
 
-        // Retrieve the value 
-        T value = current->value;
+        auto take = [this](const Priority& priority, auto&& value) {
+            emplace(priority, std::forward<decltype(value)>(value));
+        };
+        takeInOrder(other.root, true, take);
+        other.clear();
+    }
 
-        // Remove the lowest-priority element
-        if (current->link) {
-            NODE* replaceNode = current->link;
-            if (parent) {
-                parent->left = replaceNode;
-            } else {
-                root = replaceNode;
-            }
-            replaceNode->left = current->left;
-            replaceNode->right = current->right;
-            replaceNode->parent = parent;
-        } else {
-            // If there's no linked node
-            if (parent) {
-                // Otherwise, update the parent's left child to the right child of the current node
-                parent->left = current->right;
-            } else {
-                // Root case to replace root if it is the next to get dequeued
-                root = current->right;
-            }
-            if (current->right) {
-                // Set the right path with the parent that lost its other child
-                current->right->parent = parent;
-            }
+    // Split: Moves every element with a priority before `priority` into a new
+    // queue and returns it, cutting the treap along one O(log n) path
+    prqueue split(const Priority& priority) {
+        prqueue lower(comp);
+        auto goesLow = [&](const Priority& p) { return before(p, priority); };
+        ownPath(&root, goesLow);
+        trail.clear();
+        splitOwned(root, goesLow, lower.root, root);
+        return lower;
+    }
+
+    // Extract_range: Moves the values with priorities in [lo, hi) to `out` in
+    // queue order and removes them. The range is cut out along two O(log n)
+    // paths and the parts around it joined; values still shared with a copy
+    // are copied out, the others moved.
+    template<typename OutputIt>
+    OutputIt extract_range(const Priority& lo, const Priority& hi, OutputIt out) {
+        if (!before(lo, hi)) {
+            return out;
+        }
+        auto belowLo = [&](const Priority& p) { return before(p, lo); };
+        auto belowHi = [&](const Priority& p) { return before(p, hi); };
+        ownPath(&root, belowLo);
+        trail.clear();
+        NODE* below;
+        NODE* rest;
+        splitOwned(root, belowLo, below, rest);
+        try {
+            ownPath(&rest, belowHi);
+        } catch (...) {
+            root = joinOwned(below, rest);  // The spines along the cut are still owned
+            throw;
         }
+        NODE* range;
+        NODE* above;
+        splitOwned(rest, belowHi, range, above);
+        root = joinOwned(below, above);
 
-        delete current;
+        // On an exception the rest of the range is dropped with the values already taken
+        try {
+            auto take = [&out](const Priority&, auto&& value) {
+                *out = std::forward<decltype(value)>(value);
+                ++out;
+            };
+            takeInOrder(range, true, take);
+        } catch (...) {
+            release(range);
+            throw;
+        }
+        release(range);
+        return out;
+    }
 
-        // Decrease the size of the priority queue
-        sz--;
+    // Dequeue: Returns the value of the next element in the priority queue and removes it
+    T dequeue() {
+        if (!root) {
+            throw runtime_error("prqueue: dequeue from an empty queue");
+        }
+
+        // Own the path down the left spine, then move the value out of its last NODE
+        NODE** link = &root;
+        while (own(*link)->left) {
+            link = &(*link)->left;
+        }
+        trail.clear();
+        NODE* node = *link;
+        T value = std::move(node->value);
 
+        for (NODE* above = root; above != node; above = above->left) {
+            above->weight--;
+        }
+        *link = node->right;
+        node->right = nullptr;
+        destroyNode(node);
         return value;
     }
 
+    // Dequeue_n: Moves up to `k` lowest priority values to `out` in queue order
+    template<typename OutputIt>
+    OutputIt dequeue_n(int k, OutputIt out) {
+        while (k-- > 0 && root) {
+            *out = dequeue();
+            ++out;
+        }
+        return out;
+    }
+
+    // Dequeue_while: Moves values to `out` in queue order while pred(value, priority) holds
+    template<typename Pred, typename OutputIt>
+    OutputIt dequeue_while(Pred pred, OutputIt out) {
+        while (root && pred(peek(), peekPriority())) {
+            *out = dequeue();
+            ++out;
+        }
+        return out;
+    }
+
     // Size: Returns the number of elements in the priority queue
     int size() {
-        return sz;
+        return weightOf(root);
     }
 
-    // Begin: Resets internal state for an inorder traversal
-    void begin() {
-        if (root == nullptr) {
-            curr = nullptr; // The tree is empty, so no elements to traverse
-            return;
-        }
+    // Count: Returns the number of elements with exactly `priority`, in O(log n)
+    int count(const Priority& priority) const {
+        return countLow([&](const Priority& p) { return !before(priority, p); }) - rank(priority);
+    }
 
-        // Find the leftmost (smallest priority) node to start the traversal
-        curr = root;
-        while (curr->left != nullptr) {
-            curr = curr->left;
+    // Contains: Tells whether any element has `priority`, in O(log n)
+    bool contains(const Priority& priority) const {
+        for (const NODE* node = root; node;) {
+            if (before(priority, node->priority)) {
+                node = node->left;
+            } else if (before(node->priority, priority)) {
+                node = node->right;
+            } else {
+                return true;
+            }
         }
+        return false;
     }
 
-    // Next: Uses the internal state to return the next inorder priority
-bool next(T& value, int& priority) {
-    if (curr == nullptr) {
-        return false; // Internal state has reached null, indicating the end of traversal
+    // Rank: Returns the number of elements whose priority comes before `priority`, in O(log n)
+    int rank(const Priority& priority) const {
+        return countLow([&](const Priority& p) { return before(p, priority); });
     }
 
-    value = curr->value;
-    priority = curr->priority;
-    // Check for duplicates and move to the next linked list node
-    if (curr->link) {
-        curr = curr->link; // Move to the next node in the linked list of duplicates
+    // Begin: Resets internal state for an in-order traversal. Any change to
+    // the queue ends the traversal.
+    void begin() {
+        trail.clear();
+        pushLeft(trail, root);
+    }
 
-    } else if (curr->right != nullptr){
-        // If there's a right subtree, go to the right child
-        curr = curr->right;
-        while (curr->left != nullptr) {
-            curr = curr->left;
+    // Next: Uses the internal state to return the next element in queue order.
+    // Like the tree engines, the last element comes back together with false.
+    bool next(T& value, Priority& priority) {
+        if (trail.empty()) {
+            return false;
         }
-    } else{
 
-    
-    while (curr->dup == true){
-        curr = curr->parent;
+        const NODE* node = popNext(trail);
+        value = node->value;
+        priority = node->priority;
+        return !trail.empty();
     }
-    // Find the next inorder node (successor) in the BST
-    if (curr->right != nullptr) {
-        // If there's a right subtree, go to the right child
-        curr = curr->right;
-        while (curr->left != nullptr) {
-            curr = curr->left;
+
+    // toString: Returns a string representation of the entire priority queue
+    string toString() const {
+        prq::text_writer output;
+        output.expect(size_t(weightOf(root)));
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.line(priority, value);
+        });
+        return output.take();
+    }
+
+    // write_to: Streams the toString text to `out` in buffered chunks
+    void write_to(ostream& out) const {
+        prq::text_writer output(&out);
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.line(priority, value);
+        });
+        output.flush();
+    }
+
+    // Save: Writes a binary snapshot of the queue for load(), see prq::serializer
+    void save(const string& path) const {
+        prq::snapshot_writer<T, Priority> output(path, size_t(weightOf(root)));
+        visitInOrder([&](const Priority& priority, const T& value) {
+            output.add(priority, value);
+        });
+        output.finish();
+    }
+
+    // Load: Replaces the contents with a snapshot written by save(). The file
+    // is memory-mapped and decoded straight into assign(). Throws
+    // runtime_error on a missing, foreign or truncated file and then leaves
+    // the queue as it was.
+    void load(const string& path) {
+        prq::snapshot_reader<T, Priority> file(path);
+        prqueue loaded(comp);
+        loaded.assign(file.begin(), file.end());
+        swap(loaded);
+    }
+
+    // Peek: Returns the value of the next element in the priority queue without
+    // removing it, found at the end of the left spine in O(log n)
+    const T& peek() const {
+        if (!root) {
+            throw runtime_error("prqueue: peek at an empty queue");
         }
-    } else {
-        // If there's no right subtree, move up to the parent until we reach a node that hasn't been traversed
+        const NODE* node = root;
+        while (node->left) {
+            node = node->left;
+        }
+        return node->value;
+    }
 
-        while ( curr->parent != nullptr && curr->parent->priority < priority) {
-            curr = curr->parent;
+    // PeekPriority: Returns the priority of the next element without removing it
+    const Priority& peekPriority() const {
+        if (!root) {
+            throw runtime_error("prqueue: peek at an empty queue");
         }
-        curr = curr->parent;
+        const NODE* node = root;
+        while (node->left) {
+            node = node->left;
+        }
+        return node->priority;
     }
 
-    // Retrieve the value and priority from the current node
+    // Equality operator: Compares the contents of two priority queues in queue
+    // order. A copy that neither queue has changed since shares the root and
+    // compares equal in O(1).
+    bool operator==(const prqueue& other) const {
+        if (root == other.root) {
+            return true;
+        }
+        if (weightOf(root) != weightOf(other.root)) {
+            return false;
+        }
 
+        vector<const NODE*> mine, theirs;
+        pushLeft(mine, root);
+        pushLeft(theirs, other.root);
+        while (!mine.empty()) {
+            const NODE* a = popNext(mine);
+            const NODE* b = popNext(theirs);
+            if (!samePriority(a->priority, b->priority) || a->value != b->value) {
+                return false;
+            }
+        }
+        return true;
+    }
 
+    // Hash_code: Hash of the contents that agrees with operator==, in one
+    // O(n) pass. std::hash<prqueue> calls it; T needs a std::hash of its own.
+    size_t hash_code() const {
+        using ContentHash = prq::content_hash<T, Priority, Compare>;
+        static_assert(ContentHash::enabled, "prqueue: hash_code needs std::hash of the value type");
+        size_t sum = 0;
+        visitInOrder([&sum](const Priority& priority, const T& value) {
+            sum += ContentHash::term(priority, value);
+        });
+        return ContentHash::finish(sum, size_t(weightOf(root)));
     }
-    if (curr == nullptr){
-        return false;
+
+    // getRoot - Returns the NODE at the root of the treap (nullptr when empty)
+    void* getRoot() {
+        return root;
     }
+};
 
-    return  true; // Return true, indicating that a value and priority were successfully returned
+
+// Stream output: Writes the same text as toString, one line per element
+template<typename T, typename Priority, typename Compare, typename Engine, typename Alloc,
+         typename = enable_if_t<prq::printable<T>::value && prq::printable<Priority>::value>>
+ostream& operator<<(ostream& out, const prqueue<T, Priority, Compare, Engine, Alloc>& pq) {
+    pq.write_to(out);
+    return out;
 }
 
 
-    // toString: Returns a string representation of the entire priority queue
-string toString() {
-    ostringstream oss;  // Create a stringstream to build the result
-    _toStringRecursive(root, oss);  // Start the recursive traversal
-    return oss.str();  // Convert the stringstream to a string and return it
+// Swap: Lets std::swap and unqualified swap calls use the O(1) member swap
+template<typename T, typename Priority, typename Compare, typename Engine, typename Alloc>
+void swap(prqueue<T, Priority, Compare, Engine, Alloc>& a,
+          prqueue<T, Priority, Compare, Engine, Alloc>& b) noexcept {
+    a.swap(b);
 }
 
 
-    // Peek: Returns the value of the next element in the priority queue without removing it
-    T peek() {
-        T value;
-        int priority;
+// Hash: Lets prqueues of hashable values key unordered containers, see hash_code()
+namespace std {
+    template<typename T, typename Priority, typename Compare, typename Engine, typename Alloc>
+    struct hash<prqueue<T, Priority, Compare, Engine, Alloc>> {
+        size_t operator()(const prqueue<T, Priority, Compare, Engine, Alloc>& pq) const {
+            return pq.hash_code();
+        }
+    };
+}
 
-        // Start at the root
-        NODE* current = root;
 
-        // Traverse to the leftmost (lowest priority) leaf node
-        while (current->left != nullptr) {
-            current = current->left;
-        }
+// Priority queue shared by many threads, built as a MultiQueue: the elements
+// are spread over several independently locked prqueue shards. enqueue locks
+// one random shard; try_dequeue samples two shards and takes the lower of
+// their minimums.
+//
+// Ordering is relaxed, the queue is not linearizable as a priority queue:
+// - enqueue and each shard's dequeue are linearizable (they run under the
+//   shard lock), so no element is lost or handed out twice.
+// - try_dequeue returns an element that is near, but not always at, the
+//   global minimum (expected rank O(number of shards)), and FIFO order of
+//   equal priorities only holds within a shard.
+// - try_dequeue returns false only after seeing every shard empty, which can
+//   race with a concurrent enqueue.
+// - size() is a relaxed counter that may lag behind in-flight operations.
+// Shards use std::allocator so each thread's malloc arena does the work
+// instead of the process-wide slab pool.
+template<typename T, typename Engine = prq::dary_heap<4>>
+class concurrent_prqueue {
+private:
+    // Published top of an empty shard; every int priority, INT_MAX too, is below it
+    static constexpr long long emptyTop = LLONG_MAX;
 
-        value = current->value;
+    struct alignas(64) SHARD {
+        mutex lock;                         // Guards `queue`
+        prqueue<T, int, less<int>, Engine, allocator<T>> queue;
+        atomic<long long> top{emptyTop};    // Lowest priority in `queue`, emptyTop when empty
+    };
 
-        return value;
+    // Helper function for a cheap per-thread random shard index (xorshift)
+    size_t randomShard() {
+        thread_local unsigned long long state =
+            0x9E3779B97F4A7C15ULL ^ hash<thread::id>()(this_thread::get_id());
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return size_t(state % count);
     }
 
-    // Equality operator: Compares two priority queues for equality
-    bool operator==(const prqueue& other) const {
-        // Check if the sizes are different
-        if (sz != other.sz) {
+    // Helper function to refresh the lock-free copy of a shard's minimum (lock held)
+    static void publishTop(SHARD& shard) {
+        long long top = shard.queue.size() > 0 ? shard.queue.peekPriority() : emptyTop;
+        shard.top.store(top, memory_order_relaxed);
+    }
+
+    // Helper function to dequeue from one shard (lock held), false when it is empty
+    bool popShard(SHARD& shard, T& value) {
+        if (shard.queue.size() == 0) {
             return false;
         }
-
-        // Recursively compare the content of both BSTs
-        return areTreesEqual(root, other.root);
+        value = shard.queue.dequeue();
+        publishTop(shard);
+        sz.fetch_sub(1, memory_order_relaxed);
+        return true;
     }
 
-    // getRoot - Used for testing the BST, do not edit/change
-    void* getRoot() {
-        return root;
+    size_t count;               // Number of shards
+    unique_ptr<SHARD[]> shards; // The independently locked queues
+    atomic<long> sz;            // Approximate number of elements
+
+public:
+    // Constructor: `shardCount` defaults to twice the number of hardware threads
+    explicit concurrent_prqueue(size_t shardCount = 2 * max(1u, thread::hardware_concurrency()))
+        : count(max<size_t>(shardCount, 1)), shards(new SHARD[count]), sz(0) {}
+
+    concurrent_prqueue(const concurrent_prqueue&) = delete;
+    concurrent_prqueue& operator=(const concurrent_prqueue&) = delete;
+
+    // Enqueue: Adds the value to a random shard, skipping shards that are busy
+    template<typename U>
+    void enqueue(U&& value, int priority) {
+        size_t index = randomShard();
+        for (size_t tries = 0; tries < count; tries++) {
+            SHARD& shard = shards[index];
+            if (shard.lock.try_lock()) {
+                lock_guard<mutex> guard(shard.lock, adopt_lock);
+                shard.queue.enqueue(std::forward<U>(value), priority);
+                if (priority < shard.top.load(memory_order_relaxed)) {
+                    shard.top.store(priority, memory_order_relaxed);
+                }
+                sz.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+            index = (index + 1) % count;
+        }
+
+        // Every shard was busy, wait for the one we started from
+        SHARD& shard = shards[index];
+        lock_guard<mutex> guard(shard.lock);
+        shard.queue.enqueue(std::forward<U>(value), priority);
+        if (priority < shard.top.load(memory_order_relaxed)) {
+            shard.top.store(priority, memory_order_relaxed);
+        }
+        sz.fetch_add(1, memory_order_relaxed);
     }
-};
 
+    // Try_dequeue: Moves a near-minimum value into `value`; false if the queue looked empty
+    bool try_dequeue(T& value) {
+        // Two random choices: lock the shard with the lower published minimum
+        size_t a = randomShard();
+        size_t b = randomShard();
+        if (shards[b].top.load(memory_order_relaxed) < shards[a].top.load(memory_order_relaxed)) {
+            a = b;
+        }
+        if (shards[a].top.load(memory_order_relaxed) != emptyTop) {
+            lock_guard<mutex> guard(shards[a].lock);
+            if (popShard(shards[a], value)) {
+                return true;
+            }
+        }
 
+        // Both samples were empty (or got emptied): sweep every shard once
+        for (size_t i = 0; i < count; i++) {
+            SHARD& shard = shards[(a + i) % count];
+            if (shard.top.load(memory_order_relaxed) == emptyTop) {
+                continue;
+            }
+            lock_guard<mutex> guard(shard.lock);
+            if (popShard(shard, value)) {
+                return true;
+            }
+        }
+        return false;
+    }
 
+    // Size: Returns the approximate number of elements
+    long size() const {
+        long current = sz.load(memory_order_relaxed);
+        return current < 0 ? 0 : current;
+    }
+};
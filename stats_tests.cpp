@@ -0,0 +1,109 @@
+/// @file stats_tests.cpp
+/// 
+/// Test cases for the tree engines' work counters. They need the header
+/// built with PRQUEUE_STATS, so they live apart from tests.cpp, which
+/// checks the default build.
+///
+
+// Catch 2.x - Single Include Framework Testing
+#define CATCH_CONFIG_MAIN
+
+#define PRQUEUE_STATS 1
+
+#include "prqueue.h"
+#include "catch.hpp"
+
+#include <numeric>
+#include <vector>
+
+using namespace std;
+
+TEST_CASE("Stats count the work and measure the tree", "[prqueue][stats]") {
+    // The queue of the ToString test: Ben 1, Jen 2, Sven 2, Gwen 3
+    prqueue<string> pq;
+    pq.enqueue("Ben", 1);
+    pq.enqueue("Jen", 2);
+    pq.enqueue("Sven", 2);
+    pq.enqueue("Gwen", 3);
+
+    prq::queue_stats stats = pq.stats();
+    REQUIRE(stats.height == 3);       // Ben - Jen - Gwen down the right
+    REQUIRE(stats.distinct == 3);
+    REQUIRE(stats.maxChain == 2);     // Jen, Sven
+    REQUIRE(stats.averageChain == Approx(4.0 / 3.0));
+    REQUIRE(stats.enqueues == 4);
+    REQUIRE(stats.enqueueVisits == 5);  // 0 + Ben + Ben, Jen + Ben, Jen
+    REQUIRE(stats.allocations == 4);
+    REQUIRE(stats.deallocations == 0);
+    REQUIRE(accumulate(begin(stats.enqueueLatency), end(stats.enqueueLatency), uint64_t(0)) == 4);
+
+    // Sven climbs back to Jen, Gwen climbs to the root and off the top
+    string value;
+    int priority;
+    pq.begin();
+    while (pq.next(value, priority)) {
+    }
+    stats = pq.stats();
+    REQUIRE(stats.nexts == 4);
+    REQUIRE(stats.nextVisits == 7);
+
+    pq.reset_stats();
+    while (pq.size() > 0) {
+        pq.dequeue();
+    }
+    stats = pq.stats();
+    REQUIRE(stats.height == 0);
+    REQUIRE(stats.enqueues == 0);
+    REQUIRE(stats.dequeues == 4);
+    REQUIRE(stats.dequeueVisits == 4);
+    REQUIRE(stats.deallocations == 4);
+    REQUIRE(accumulate(begin(stats.dequeueLatency), end(stats.dequeueLatency), uint64_t(0)) == 4);
+}
+
+TEST_CASE("Stats show a degenerate tree and long duplicate chains", "[prqueue][stats]") {
+    prqueue<int> plain;
+    prqueue<int, int, less<int>, prq::red_black> balanced;
+    for (int i = 0; i < 1000; i++) {
+        plain.enqueue(i, i);
+        balanced.enqueue(i, i);
+    }
+    REQUIRE(plain.stats().height == 1000);
+    REQUIRE(balanced.stats().height <= 20);
+    REQUIRE(balanced.stats().enqueueVisits < plain.stats().enqueueVisits / 10);
+
+    prqueue<int, int, less<int>, prq::red_black> few;
+    for (int i = 0; i < 100; i++) {
+        few.enqueue(i, i % 4);
+    }
+    prq::queue_stats stats = few.stats();
+    REQUIRE(stats.distinct == 4);
+    REQUIRE(stats.maxChain == 25);
+    REQUIRE(stats.averageChain == Approx(25.0));
+}
+
+TEST_CASE("Stats count each element dequeue_n and dequeue_while hand out", "[prqueue][stats]") {
+    prqueue<int, int, less<int>, prq::red_black> pq;
+    for (int i = 0; i < 20; i++) {
+        pq.enqueue(i, 7);
+    }
+    pq.enqueue(20, 9);
+
+    // Both drain whole stretches of the duplicate chain at a time
+    vector<int> out;
+    pq.dequeue_n(10, back_inserter(out));
+    REQUIRE(pq.stats().dequeues == 10);
+    pq.dequeue_while([](const int& value, const int&) { return value < 15; }, back_inserter(out));
+    REQUIRE(pq.stats().dequeues == 15);
+    pq.dequeue_n(6, back_inserter(out));
+    REQUIRE(pq.stats().dequeues == 21);
+    REQUIRE(out.size() == 21);
+
+    // Taking the front out through a handle is not a dequeue
+    auto front = pq.enqueue(30, 1);
+    auto next = pq.enqueue(31, 2);
+    pq.erase(front);
+    pq.update_priority(next, 5);
+    REQUIRE(pq.stats().dequeues == 21);
+    REQUIRE(pq.dequeue() == 31);
+    REQUIRE(pq.stats().dequeues == 22);
+}
@@ -15,6 +15,12 @@
 #include "prqueue.h"
 #include "catch.hpp"
 
+#include <deque>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <unordered_set>
+
 using namespace std;
 
 // This is a basic test case example with sections.
@@ -434,3 +440,1787 @@ TEST_CASE("Equality operator returns false for priority queues with different si
 
 
 
+TEST_CASE("Red-black engine keeps priority and FIFO order on sorted input") {
+    prqueue<int, int, less<int>, prq::red_black> pq;
+
+    // Ascending priorities with every priority enqueued twice
+    for (int i = 0; i < 1000; i++) {
+        pq.enqueue(2 * i, i);
+        pq.enqueue(2 * i + 1, i);
+    }
+
+    SECTION("Check size after enqueue") {
+        REQUIRE(pq.size() == 2000);
+    }
+
+    SECTION("Check dequeue order") {
+        for (int i = 0; i < 2000; i++) {
+            REQUIRE(pq.dequeue() == i);
+        }
+        REQUIRE(pq.size() == 0);
+    }
+
+    SECTION("Check inorder traversal") {
+        int value;
+        int priority;
+        int count = 0;
+
+        pq.begin();
+        while (pq.next(value, priority)) {
+            REQUIRE(value == count);
+            REQUIRE(priority == count / 2);
+            count++;
+        }
+        // next() hands out the last element together with false
+        REQUIRE(value == 1999);
+        REQUIRE(count == 1999);
+    }
+}
+
+TEST_CASE("Red-black engine matches the plain BST on mixed input") {
+    prqueue<string, int, less<int>, prq::bst> plain;
+    prqueue<string, int, less<int>, prq::red_black> balanced;
+
+    for (int i = 0; i < 500; i++) {
+        int priority = (i * 7919) % 97;
+        plain.enqueue(to_string(i), priority);
+        balanced.enqueue(to_string(i), priority);
+    }
+
+    REQUIRE(plain.toString() == balanced.toString());
+
+    // Interleave dequeues with more enqueues
+    for (int i = 0; i < 250; i++) {
+        REQUIRE(plain.dequeue() == balanced.dequeue());
+        plain.enqueue("x" + to_string(i), i % 13);
+        balanced.enqueue("x" + to_string(i), i % 13);
+    }
+    while (plain.size() > 0) {
+        REQUIRE(plain.dequeue() == balanced.dequeue());
+    }
+    REQUIRE(balanced.size() == 0);
+}
+
+TEST_CASE("Peek follows the lowest priority through enqueue and dequeue") {
+    prqueue<string> pq;
+
+    pq.enqueue("Carl", 5);
+    REQUIRE(pq.peek() == "Carl");
+
+    pq.enqueue("Ann", 3);   // New minimum below the current one
+    pq.enqueue("Ann2", 3);  // Duplicate of the minimum
+    pq.enqueue("Zed", 9);
+    pq.enqueue("Dora", 4);
+    REQUIRE(pq.peek() == "Ann");
+
+    REQUIRE(pq.dequeue() == "Ann");
+    REQUIRE(pq.peek() == "Ann2");   // Promoted duplicate
+    REQUIRE(pq.dequeue() == "Ann2");
+    REQUIRE(pq.peek() == "Dora");   // Successor from the right subtree
+    REQUIRE(pq.dequeue() == "Dora");
+    REQUIRE(pq.peek() == "Carl");   // Successor is the parent
+    REQUIRE(pq.dequeue() == "Carl");
+    REQUIRE(pq.peek() == "Zed");
+
+    pq.enqueue("Bea", 1);
+    REQUIRE(pq.peek() == "Bea");
+
+    prqueue<string> copy;
+    copy = pq;
+    REQUIRE(copy.peek() == "Bea");
+    REQUIRE(copy.dequeue() == "Bea");
+    REQUIRE(copy.peek() == "Zed");
+}
+
+// Allocator that counts live NODEs so tests can check every allocation is returned,
+// and every allocate() call so tests can check an operation allocates nothing
+int liveNodes = 0;
+int allocations = 0;
+
+template<typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    CountingAllocator() = default;
+
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        liveNodes += int(n);
+        allocations++;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        liveNodes -= int(n);
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template<typename U>
+    bool operator==(const CountingAllocator<U>&) const { return true; }
+
+    template<typename U>
+    bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+TEST_CASE("Custom allocator is used for every NODE") {
+    liveNodes = 0;
+    {
+        prqueue<string, int, less<int>, prq::red_black, CountingAllocator<string>> pq;
+        pq.enqueue("a", 2);
+        pq.enqueue("b", 1);
+        pq.enqueue("c", 2);
+        pq.enqueue("d", 3);
+        REQUIRE(liveNodes == 4);
+
+        prqueue<string, int, less<int>, prq::red_black, CountingAllocator<string>> copy;
+        copy = pq;
+        REQUIRE(liveNodes == 8);
+
+        REQUIRE(pq.dequeue() == "b");
+        REQUIRE(pq.dequeue() == "a");
+        REQUIRE(liveNodes == 6);
+
+        copy.clear();
+        REQUIRE(liveNodes == 2);
+    }
+    REQUIRE(liveNodes == 0);
+}
+
+TEST_CASE("Pool allocator recycles NODEs across queues") {
+    prqueue<int> pq;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 1000; i++) {
+            pq.enqueue(i, (i * 31) % 100);
+        }
+        prqueue<int> copy;
+        copy = pq;
+        REQUIRE(copy.toString() == pq.toString());
+        for (int i = 0; i < 1000; i++) {
+            pq.dequeue();
+        }
+        REQUIRE(pq.size() == 0);
+    }
+}
+
+TEMPLATE_TEST_CASE("Array-backed engines behave like the tree engine", "[prqueue][heap]",
+                   prq::dary_heap<2>, prq::dary_heap<4>, prq::dary_heap<8>, prq::buckets<64>,
+                   prq::compact) {
+    prqueue<string> tree;
+    prqueue<string, int, less<int>, TestType> heap;
+
+    for (int i = 0; i < 300; i++) {
+        int priority = (i * 37) % 41;
+        tree.enqueue(to_string(i), priority);
+        heap.enqueue(to_string(i), priority);
+    }
+
+    REQUIRE(heap.size() == 300);
+    REQUIRE(heap.toString() == tree.toString());
+    REQUIRE(heap.peek() == tree.peek());
+
+    SECTION("Traversal visits elements in queue order") {
+        string treeValue, heapValue;
+        int treePriority, heapPriority;
+        tree.begin();
+        heap.begin();
+        bool more = true;
+        while (more) {
+            more = tree.next(treeValue, treePriority);
+            REQUIRE(heap.next(heapValue, heapPriority) == more);
+            REQUIRE(heapValue == treeValue);
+            REQUIRE(heapPriority == treePriority);
+        }
+    }
+
+    SECTION("Copies compare equal until one is dequeued") {
+        prqueue<string, int, less<int>, TestType> copy;
+        copy = heap;
+        REQUIRE(copy == heap);
+        copy.dequeue();
+        REQUIRE_FALSE(copy == heap);
+    }
+
+    SECTION("Dequeue keeps priority and FIFO order") {
+        while (tree.size() > 0) {
+            REQUIRE(heap.dequeue() == tree.dequeue());
+        }
+        REQUIRE(heap.size() == 0);
+    }
+}
+
+// Payload that counts how often it is copied or moved and has no default constructor
+struct Tracked {
+    static int copies;
+    static int moves;
+
+    string name;
+
+    explicit Tracked(string name) : name(std::move(name)) {}
+    Tracked(const Tracked& other) : name(other.name) { copies++; }
+    Tracked(Tracked&& other) noexcept : name(std::move(other.name)) { moves++; }
+    Tracked& operator=(const Tracked& other) { name = other.name; copies++; return *this; }
+    Tracked& operator=(Tracked&& other) noexcept { name = std::move(other.name); moves++; return *this; }
+    bool operator!=(const Tracked& other) const { return name != other.name; }
+};
+
+int Tracked::copies = 0;
+int Tracked::moves = 0;
+
+ostream& operator<<(ostream& out, const Tracked& tracked) {
+    return out << tracked.name;
+}
+
+TEMPLATE_TEST_CASE("Enqueue to dequeue makes no copies of the value", "[prqueue][move]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<16>, prq::compact, prq::persistent) {
+    prqueue<Tracked, int, less<int>, TestType> pq;
+    Tracked::copies = 0;
+
+    pq.enqueue(Tracked("moved"), 2);
+    Tracked named("named");
+    pq.enqueue(std::move(named), 1);
+    pq.emplace(3, "emplaced");
+    pq.emplace(1, "tie");
+
+    REQUIRE(pq.peek().name == "named");
+    REQUIRE(pq.dequeue().name == "named");
+    REQUIRE(pq.dequeue().name == "tie");
+    REQUIRE(pq.dequeue().name == "moved");
+    REQUIRE(pq.dequeue().name == "emplaced");
+    REQUIRE(Tracked::copies == 0);
+
+    SECTION("Const lvalues are copied exactly once") {
+        const Tracked kept("kept");
+        pq.enqueue(kept, 5);
+        REQUIRE(Tracked::copies == 1);
+        REQUIRE(pq.dequeue().name == "kept");
+        REQUIRE(Tracked::copies == 1);
+    }
+
+    SECTION("Peek and dequeue on an empty queue throw") {
+        REQUIRE_THROWS_AS(pq.peek(), std::runtime_error);
+        REQUIRE_THROWS_AS(pq.dequeue(), std::runtime_error);
+    }
+}
+
+TEMPLATE_TEST_CASE("Bulk build matches repeated enqueue", "[prqueue][assign]",
+                   prq::bst, prq::red_black, prq::ranked, prq::dary_heap<4>, prq::compact,
+                   prq::persistent) {
+    vector<pair<string, int>> snapshot;
+    for (int i = 0; i < 1000; i++) {
+        snapshot.push_back({"v" + to_string(i), (i * 13) % 50});
+    }
+
+    prqueue<string> expected;
+    for (auto& entry : snapshot) {
+        expected.enqueue(entry.first, entry.second);
+    }
+
+    SECTION("Range constructor") {
+        prqueue<string, int, less<int>, TestType> built(snapshot.begin(), snapshot.end());
+        REQUIRE(built.size() == 1000);
+        REQUIRE(built.toString() == expected.toString());
+        while (expected.size() > 0) {
+            REQUIRE(built.dequeue() == expected.dequeue());
+        }
+    }
+
+    SECTION("Assign replaces the contents and moves values") {
+        prqueue<string, int, less<int>, TestType> built;
+        built.enqueue("old", -1);
+        built.assign(make_move_iterator(snapshot.begin()), make_move_iterator(snapshot.end()));
+        REQUIRE(snapshot.front().first.empty());
+        REQUIRE(built.size() == 1000);
+        REQUIRE(built.toString() == expected.toString());
+
+        // The built queue keeps working with ordinary operations
+        built.enqueue("late", 0);
+        expected.enqueue("late", 0);
+        while (expected.size() > 0) {
+            REQUIRE(built.dequeue() == expected.dequeue());
+        }
+    }
+
+    SECTION("Empty and sorted ranges") {
+        prqueue<string, int, less<int>, TestType> empty(snapshot.end(), snapshot.end());
+        REQUIRE(empty.size() == 0);
+
+        vector<pair<string, int>> sorted = {{"a", 1}, {"b", 1}, {"c", 2}, {"d", 3}};
+        prqueue<string, int, less<int>, TestType> built(sorted.begin(), sorted.end());
+        REQUIRE(built.toString() == "1 value: a\n1 value: b\n2 value: c\n3 value: d\n");
+    }
+}
+
+TEMPLATE_TEST_CASE("Batch dequeue drains in queue order", "[prqueue][batch]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<8>, prq::compact, prq::persistent) {
+    prqueue<string, int, less<int>, TestType> pq;
+    prqueue<string> expected;
+    for (int i = 0; i < 200; i++) {
+        pq.enqueue(to_string(i), i % 7);
+        expected.enqueue(to_string(i), i % 7);
+    }
+
+    SECTION("dequeue_n stops inside a duplicate chain") {
+        vector<string> batch;
+        pq.dequeue_n(30, back_inserter(batch));   // Priority 0 has 29 entries
+        REQUIRE(batch.size() == 30);
+        REQUIRE(pq.size() == 170);
+        for (const string& value : batch) {
+            REQUIRE(value == expected.dequeue());
+        }
+        REQUIRE(pq.toString() == expected.toString());
+        REQUIRE(pq.peek() == "8");
+    }
+
+    SECTION("dequeue_n with more than the queue holds") {
+        vector<string> batch;
+        pq.dequeue_n(1000, back_inserter(batch));
+        REQUIRE(batch.size() == 200);
+        REQUIRE(pq.size() == 0);
+        pq.enqueue("again", 3);
+        REQUIRE(pq.dequeue() == "again");
+    }
+
+    SECTION("dequeue_while takes whole priorities") {
+        vector<string> batch;
+        pq.dequeue_while([](const string&, int priority) { return priority <= 2; },
+                         back_inserter(batch));
+        REQUIRE(batch.size() == 87);
+        for (const string& value : batch) {
+            REQUIRE(value == expected.dequeue());
+        }
+        REQUIRE(pq.toString() == expected.toString());
+
+        batch.clear();
+        pq.dequeue_while([](const string&, int) { return false; }, back_inserter(batch));
+        REQUIRE(batch.empty());
+        REQUIRE(pq.size() == 113);
+    }
+}
+
+TEST_CASE("Concurrent queue with one shard is an exact priority queue") {
+    concurrent_prqueue<string> pq(1);
+    pq.enqueue("b", 2);
+    pq.enqueue("a", 1);
+    pq.enqueue("b2", 2);
+    REQUIRE(pq.size() == 3);
+
+    string value;
+    REQUIRE(pq.try_dequeue(value));
+    REQUIRE(value == "a");
+    REQUIRE(pq.try_dequeue(value));
+    REQUIRE(value == "b");
+    REQUIRE(pq.try_dequeue(value));
+    REQUIRE(value == "b2");
+    REQUIRE_FALSE(pq.try_dequeue(value));
+    REQUIRE(pq.size() == 0);
+}
+
+TEST_CASE("Concurrent queue stress: every element is dequeued exactly once") {
+    const int producers = 4;
+    const int consumers = 4;
+    const int perProducer = 20000;
+    const int total = producers * perProducer;
+
+    concurrent_prqueue<int> pq(8);
+    vector<atomic<int>> seen(total);
+    atomic<int> consumed(0);
+    vector<thread> threads;
+
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            for (int i = 0; i < perProducer; i++) {
+                int id = p * perProducer + i;
+                pq.enqueue(id, (id * 7919) % 1000);
+            }
+        });
+    }
+    for (int c = 0; c < consumers; c++) {
+        threads.emplace_back([&] {
+            int value;
+            while (consumed.load() < total) {
+                if (pq.try_dequeue(value)) {
+                    seen[value].fetch_add(1);
+                    consumed.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (thread& t : threads) {
+        t.join();
+    }
+
+    REQUIRE(consumed.load() == total);
+    REQUIRE(pq.size() == 0);
+    int duplicates = 0;
+    for (int i = 0; i < total; i++) {
+        if (seen[i].load() != 1) {
+            duplicates++;
+        }
+    }
+    REQUIRE(duplicates == 0);
+}
+
+TEST_CASE("Concurrent queue stress: elements at INT_MAX are dequeued too") {
+    concurrent_prqueue<int> single(1);
+    single.enqueue(7, INT_MAX);
+    int value;
+    REQUIRE(single.try_dequeue(value));
+    REQUIRE(value == 7);
+    REQUIRE_FALSE(single.try_dequeue(value));
+
+    const int producers = 4;
+    const int consumers = 4;
+    const int perProducer = 20000;
+    const int total = producers * perProducer;
+
+    concurrent_prqueue<int> pq(8);
+    vector<atomic<int>> seen(total);
+    atomic<int> finished(0);
+    vector<thread> threads;
+
+    // Every third element sits at INT_MAX, the rest just below it
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            for (int i = 0; i < perProducer; i++) {
+                int id = p * perProducer + i;
+                pq.enqueue(id, id % 3 == 0 ? INT_MAX : INT_MAX - id % 5);
+            }
+            finished.fetch_add(1);
+        });
+    }
+    // Consumers stop once the producers are done and the queue looks empty,
+    // so an element that cannot be dequeued shows up as missing, not as a hang
+    for (int c = 0; c < consumers; c++) {
+        threads.emplace_back([&] {
+            int taken;
+            while (true) {
+                bool done = finished.load() == producers;
+                if (pq.try_dequeue(taken)) {
+                    seen[taken].fetch_add(1);
+                } else if (done) {
+                    break;
+                }
+            }
+        });
+    }
+    for (thread& t : threads) {
+        t.join();
+    }
+
+    REQUIRE(pq.size() == 0);
+    int wrong = 0;
+    for (int i = 0; i < total; i++) {
+        if (seen[i].load() != 1) {
+            wrong++;
+        }
+    }
+    REQUIRE(wrong == 0);
+}
+
+TEST_CASE("Deep sorted-priority queue is copied, compared, printed and freed without recursion") {
+    // Descending priorities put every node on the left spine, depth n
+    const int n = 10000000;
+    prqueue<int> pq;
+    for (int i = 0; i < n; i++) {
+        pq.enqueue(i, n - i);
+    }
+    REQUIRE(pq.size() == n);
+
+    {
+        prqueue<int> copy;
+        copy = pq;
+        REQUIRE(copy.size() == n);
+        REQUIRE(copy == pq);
+
+        copy.dequeue();
+        copy.enqueue(n - 1, 1);
+        REQUIRE(copy == pq);
+
+        copy.dequeue();
+        copy.enqueue(-1, 1);
+        REQUIRE_FALSE(copy == pq);
+    }
+
+    string text = pq.toString();
+    REQUIRE(text.substr(0, 17) == "1 value: 9999999\n");
+    REQUIRE(text.substr(text.size() - 18) == "10000000 value: 0\n");
+    REQUIRE(count(text.begin(), text.end(), '\n') == n);
+}
+
+TEMPLATE_TEST_CASE("Iterators walk the queue in order", "[prqueue][iterator]",
+                   prq::bst, prq::red_black, prq::ranked) {
+    prqueue<string, int, less<int>, TestType> pq;
+    pq.enqueue("c", 3);
+    pq.enqueue("a", 1);
+    pq.enqueue("b1", 2);
+    pq.enqueue("e", 5);
+    pq.enqueue("b2", 2);
+    pq.enqueue("d", 4);
+    pq.enqueue("b3", 2);
+
+    const vector<string> expected = {"a", "b1", "b2", "b3", "c", "d", "e"};
+
+    SECTION("Range-for yields references to value and priority") {
+        vector<string> values;
+        vector<int> priorities;
+        for (const auto& element : pq) {
+            values.push_back(element.value);
+            priorities.push_back(element.priority);
+        }
+        REQUIRE(values == expected);
+        REQUIRE(priorities == vector<int>{1, 2, 2, 2, 3, 4, 5});
+        REQUIRE(&pq.begin()->value == &pq.peek());
+    }
+
+    SECTION("Walking backwards from end()") {
+        vector<string> values;
+        for (auto it = pq.cend(); it != pq.cbegin();) {
+            --it;
+            values.push_back(it->value);
+        }
+        REQUIRE(values == vector<string>(expected.rbegin(), expected.rend()));
+    }
+
+    SECTION("Standard algorithms and independent iterators") {
+        const prqueue<string, int, less<int>, TestType>& view = pq;
+        REQUIRE(distance(view.begin(), view.end()) == 7);
+        REQUIRE(count_if(view.begin(), view.end(),
+                         [](const auto& element) { return element.priority == 2; }) == 3);
+        auto found = find_if(view.begin(), view.end(),
+                             [](const auto& element) { return element.value == "c"; });
+        REQUIRE(found != view.end());
+        REQUIRE(prev(found)->value == "b3");
+
+        auto slow = view.begin();
+        auto fast = view.begin();
+        ++fast;
+        ++fast;
+        ++slow;
+        REQUIRE(slow->value == "b1");
+        REQUIRE(fast->value == "b2");
+    }
+
+    SECTION("Empty queue") {
+        prqueue<string, int, less<int>, TestType> empty;
+        REQUIRE(empty.begin() == empty.end());
+    }
+}
+
+TEMPLATE_TEST_CASE("Handles erase elements anywhere in duplicate chains", "[prqueue][handle]",
+                   prq::bst, prq::red_black, prq::ranked) {
+    prqueue<string, int, less<int>, TestType> pq;
+    pq.enqueue("low", 1);
+    auto head = pq.enqueue("head", 5);
+    auto middle = pq.enqueue("middle", 5);
+    auto tail = pq.enqueue("tail", 5);
+    pq.enqueue("high", 9);
+    pq.enqueue("mid", 3);
+
+    REQUIRE(head.value() == "head");
+    REQUIRE(middle.priority() == 5);
+
+    SECTION("Erase the middle of a chain") {
+        pq.erase(middle);
+        REQUIRE(pq.size() == 5);
+        REQUIRE(pq.toString() == "1 value: low\n3 value: mid\n5 value: head\n5 value: tail\n9 value: high\n");
+    }
+
+    SECTION("Erase the head of a chain") {
+        pq.erase(head);
+        REQUIRE(pq.toString() == "1 value: low\n3 value: mid\n5 value: middle\n5 value: tail\n9 value: high\n");
+        // The promoted duplicate is a full tree node again
+        pq.erase(middle);
+        pq.enqueue("late", 5);
+        REQUIRE(pq.toString() == "1 value: low\n3 value: mid\n5 value: tail\n5 value: late\n9 value: high\n");
+    }
+
+    SECTION("Erase the tail of a chain, then the rest of it") {
+        pq.erase(tail);
+        REQUIRE(pq.toString() == "1 value: low\n3 value: mid\n5 value: head\n5 value: middle\n9 value: high\n");
+        pq.erase(head);
+        pq.erase(middle);
+        REQUIRE(pq.toString() == "1 value: low\n3 value: mid\n9 value: high\n");
+        REQUIRE(pq.dequeue() == "low");
+        REQUIRE(pq.dequeue() == "mid");
+        REQUIRE(pq.dequeue() == "high");
+    }
+
+    SECTION("Erase the lowest and highest element") {
+        auto lower = pq.enqueue("lower", 0);
+        auto higher = pq.enqueue("higher", 10);
+        REQUIRE(pq.peek() == "lower");
+        pq.erase(lower);
+        pq.erase(higher);
+        REQUIRE(pq.peek() == "low");
+        REQUIRE(pq.toString() == "1 value: low\n3 value: mid\n5 value: head\n5 value: middle\n5 value: tail\n9 value: high\n");
+    }
+
+    SECTION("Update priority moves an element, keeping its handle") {
+        pq.update_priority(middle, 0);
+        REQUIRE(pq.peek() == "middle");
+        REQUIRE(middle.priority() == 0);
+
+        pq.update_priority(middle, 9);
+        pq.update_priority(head, 9);
+        REQUIRE(pq.toString() == "1 value: low\n3 value: mid\n5 value: tail\n9 value: high\n9 value: middle\n9 value: head\n");
+
+        pq.update_priority(tail, 9);  // Leaves no node at priority 5
+        REQUIRE(pq.dequeue() == "low");
+        REQUIRE(pq.dequeue() == "mid");
+        REQUIRE(pq.dequeue() == "high");
+        REQUIRE(pq.dequeue() == "middle");
+        REQUIRE(pq.dequeue() == "head");
+        REQUIRE(pq.dequeue() == "tail");
+    }
+}
+
+TEMPLATE_TEST_CASE("Long duplicate chains keep FIFO order as they grow and shrink", "[prqueue][dups]",
+                   prq::bst, prq::red_black, prq::ranked, prq::compact, prq::persistent) {
+    using Queue = prqueue<int, int, less<int>, TestType>;
+    Queue pq;
+    map<int, deque<int>> expected;
+    auto enqueue = [&](Queue& queue, int value, int priority) {
+        queue.enqueue(value, priority);
+        expected[priority].push_back(value);
+    };
+    auto dequeueExpected = [&]() {
+        auto first = expected.begin();
+        int value = first->second.front();
+        first->second.pop_front();
+        if (first->second.empty()) {
+            expected.erase(first);
+        }
+        return value;
+    };
+
+    // Appends must land behind the last duplicate however the chain changed
+    int next = 0;
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 150; i++) {
+            enqueue(pq, next, (next * 7) % 4);
+            next++;
+        }
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(pq.dequeue() == dequeueExpected());
+        }
+    }
+
+    SECTION("Merged chains join behind ours") {
+        Queue other;
+        for (int i = 0; i < 300; i++) {
+            enqueue(other, next++, i % 5);
+        }
+        pq.merge(std::move(other));
+        for (int i = 0; i < 50; i++) {
+            enqueue(pq, next++, i % 5);
+        }
+    }
+
+    SECTION("Split halves keep their tails") {
+        Queue low = pq.split(2);
+        for (int i = 0; i < 40; i++) {
+            low.enqueue(next, i % 2);
+            pq.enqueue(next + 1, 2 + i % 2);
+            expected[i % 2].push_back(next);
+            expected[2 + i % 2].push_back(next + 1);
+            next += 2;
+        }
+        pq.merge(std::move(low));
+    }
+
+    SECTION("Copies keep their tails") {
+        Queue copy(pq);
+        pq = copy;
+        for (int i = 0; i < 50; i++) {
+            enqueue(pq, next++, i % 4);
+        }
+    }
+
+    REQUIRE(pq.size() == accumulate(expected.begin(), expected.end(), 0,
+                                    [](int total, const auto& chain) { return total + int(chain.second.size()); }));
+    while (!expected.empty()) {
+        REQUIRE(pq.dequeue() == dequeueExpected());
+    }
+    REQUIRE(pq.size() == 0);
+}
+
+TEMPLATE_TEST_CASE("Erasing the ends of a duplicate chain moves its tail", "[prqueue][dups][handle]",
+                   prq::bst, prq::red_black, prq::ranked) {
+    prqueue<string, int, less<int>, TestType> pq;
+    auto head = pq.enqueue("head", 5);
+    auto first = pq.enqueue("first", 5);
+    pq.enqueue("middle", 5);
+    auto last = pq.enqueue("last", 5);
+
+    pq.erase(last);
+    pq.enqueue("after last", 5);
+    pq.erase(first);
+    pq.enqueue("after first", 5);
+    REQUIRE(pq.toString() == "5 value: head\n5 value: middle\n5 value: after last\n5 value: after first\n");
+
+    // The promoted head hands the chain over with its tail
+    pq.erase(head);
+    auto moved = pq.enqueue("moved", 1);
+    pq.update_priority(moved, 5);
+    pq.enqueue("end", 5);
+    REQUIRE(pq.toString() == "5 value: middle\n5 value: after last\n5 value: after first\n5 value: moved\n5 value: end\n");
+
+    // Down to a chain of one and back up
+    vector<string> taken;
+    pq.dequeue_n(4, back_inserter(taken));
+    REQUIRE(pq.peek() == "end");
+    pq.enqueue("again", 5);
+    pq.enqueue("and again", 5);
+    REQUIRE(pq.toString() == "5 value: end\n5 value: again\n5 value: and again\n");
+}
+
+TEMPLATE_TEST_CASE("Comparator decides which end of the queue is served first", "",
+                   prq::bst, prq::red_black, prq::ranked, prq::dary_heap<4>, prq::compact,
+                   prq::persistent) {
+    prqueue<string, int, greater<int>, TestType> pq;
+    pq.enqueue("low", 1);
+    pq.enqueue("high", 9);
+    pq.enqueue("mid", 5);
+    pq.enqueue("high again", 9);
+
+    REQUIRE(pq.peekPriority() == 9);
+    REQUIRE(pq.toString() == "9 value: high\n9 value: high again\n5 value: mid\n1 value: low\n");
+    REQUIRE(pq.dequeue() == "high");
+    REQUIRE(pq.dequeue() == "high again");
+    REQUIRE(pq.dequeue() == "mid");
+    REQUIRE(pq.dequeue() == "low");
+}
+
+TEMPLATE_TEST_CASE("Priorities of other types keep order and FIFO ties", "",
+                   prq::bst, prq::red_black, prq::ranked, prq::dary_heap<4>, prq::compact,
+                   prq::persistent) {
+    SECTION("64-bit priorities beyond the int range") {
+        prqueue<string, long long, less<long long>, TestType> pq;
+        const long long base = 1LL << 40;
+        pq.enqueue("later", base + 2);
+        pq.enqueue("first", -base);
+        pq.enqueue("soon", base + 1);
+        pq.enqueue("soon too", base + 1);
+
+        REQUIRE(pq.peekPriority() == -base);
+        REQUIRE(pq.dequeue() == "first");
+        REQUIRE(pq.dequeue() == "soon");
+        REQUIRE(pq.dequeue() == "soon too");
+        REQUIRE(pq.dequeue() == "later");
+    }
+
+    SECTION("Floating point priorities") {
+        prqueue<int, double, less<double>, TestType> pq;
+        for (int i = 0; i < 100; i++) {
+            pq.enqueue(i, (i % 10) * 0.5);
+        }
+
+        double priority;
+        int value;
+        pq.begin();
+        REQUIRE(pq.next(value, priority));
+        REQUIRE(value == 0);
+        REQUIRE(priority == 0.0);
+
+        // Ties at the same score come out in insertion order
+        for (int score = 0; score < 10; score++) {
+            for (int i = score; i < 100; i += 10) {
+                REQUIRE(pq.dequeue() == i);
+            }
+        }
+    }
+}
+
+TEST_CASE("Bucket engine finds levels across bitmap words and rejects out-of-range priorities") {
+    // 5000 levels span 79 bitmap words and two summary words
+    prqueue<string, int, less<int>, prq::buckets<5000>> pq;
+    prqueue<string> expected;
+    const int levels[] = {4999, 4096, 4095, 64, 63, 0, 4032, 1, 4999, 0};
+    for (int i = 0; i < 10; i++) {
+        pq.enqueue(to_string(i), levels[i]);
+        expected.enqueue(to_string(i), levels[i]);
+    }
+
+    REQUIRE(pq.toString() == expected.toString());
+    REQUIRE(pq.peekPriority() == 0);
+
+    SECTION("Out-of-range priorities throw and leave the queue unchanged") {
+        REQUIRE_THROWS_AS(pq.enqueue("low", -1), std::out_of_range);
+        REQUIRE_THROWS_AS(pq.enqueue("high", 5000), std::out_of_range);
+        REQUIRE(pq.size() == 10);
+        REQUIRE(pq.toString() == expected.toString());
+    }
+
+    SECTION("Copies are deep and compare equal") {
+        prqueue<string, int, less<int>, prq::buckets<5000>> copy(pq);
+        REQUIRE(copy == pq);
+        copy.dequeue();
+        REQUIRE_FALSE(copy == pq);
+        REQUIRE(pq.size() == 10);
+    }
+
+    SECTION("Monotone use: levels refill behind the minimum") {
+        bool refilled = false;
+        while (expected.size() > 0) {
+            REQUIRE(pq.peekPriority() == expected.peekPriority());
+            REQUIRE(pq.dequeue() == expected.dequeue());
+            if (expected.size() == 5 && !refilled) {
+                pq.enqueue("refill", 2);
+                expected.enqueue("refill", 2);
+                refilled = true;
+            }
+        }
+        REQUIRE(pq.size() == 0);
+        REQUIRE(pq.getRoot() == nullptr);
+    }
+}
+
+TEST_CASE("Compact engine matches the red-black engine under random churn") {
+    prqueue<string, int, less<int>, prq::red_black> expected;
+    prqueue<string, int, less<int>, prq::compact> pq;
+    unsigned long long state = 7;
+    auto rng = [&state] {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return unsigned(state >> 33);
+    };
+
+    // Mostly enqueues at first, then mostly dequeues, over few distinct priorities
+    for (int i = 0; i < 20000; i++) {
+        bool grow = (i < 10000) ? rng() % 4 != 0 : rng() % 4 == 0;
+        if (grow || expected.size() == 0) {
+            int priority = int(rng() % 300);
+            expected.enqueue(to_string(i), priority);
+            pq.enqueue(to_string(i), priority);
+        } else {
+            REQUIRE(pq.peekPriority() == expected.peekPriority());
+            REQUIRE(pq.dequeue() == expected.dequeue());
+        }
+        if (i % 1000 == 0) {
+            REQUIRE(pq.toString() == expected.toString());
+        }
+    }
+    REQUIRE(pq.size() == expected.size());
+
+    prqueue<string, int, less<int>, prq::compact> copy;
+    copy = pq;
+    REQUIRE(copy == pq);
+    while (expected.size() > 0) {
+        REQUIRE(pq.dequeue() == expected.dequeue());
+    }
+    REQUIRE(pq.getRoot() == nullptr);
+    REQUIRE(copy.size() > 0);
+}
+
+TEMPLATE_TEST_CASE("Move and swap hand over contents without allocating", "[prqueue][move]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<16>, prq::compact, prq::persistent) {
+    using Queue = prqueue<string, int, less<int>, TestType, CountingAllocator<string>>;
+    STATIC_REQUIRE(is_nothrow_move_constructible<Queue>::value);
+    STATIC_REQUIRE(is_nothrow_move_assignable<Queue>::value);
+    liveNodes = 0;
+    {
+        Queue pq;
+        for (int i = 0; i < 100; i++) {
+            pq.enqueue(to_string(i), i % 10);
+        }
+        string expected = pq.toString();
+
+        Queue copy(pq);
+        REQUIRE(copy == pq);
+        copy.dequeue();
+        REQUIRE(pq.size() == 100);
+
+        int before = allocations;
+        Queue moved(std::move(pq));
+        REQUIRE(moved.size() == 100);
+        REQUIRE(moved.toString() == expected);
+        REQUIRE(pq.size() == 0);
+
+        copy = std::move(moved);
+        REQUIRE(copy.toString() == expected);
+        REQUIRE(moved.size() == 0);
+
+        swap(copy, pq);
+        REQUIRE(pq.toString() == expected);
+        REQUIRE(copy.size() == 0);
+        std::swap(pq, moved);
+        pq.swap(moved);
+        REQUIRE(pq.toString() == expected);
+        REQUIRE(allocations == before);
+
+        // Moved-from queues are empty and usable
+        moved.enqueue("again", 3);
+        REQUIRE(moved.dequeue() == "again");
+        REQUIRE(pq.dequeue() == "0");
+
+        SECTION("A growing vector of queues moves them") {
+            vector<Queue> epochs;
+            epochs.push_back(std::move(pq));
+            before = allocations;
+            for (int i = 0; i < 40; i++) {
+                epochs.emplace_back();
+            }
+            REQUIRE(allocations == before);
+            REQUIRE(epochs.front().size() == 99);
+            REQUIRE(epochs.front().dequeue() == "10");
+        }
+    }
+    REQUIRE(liveNodes == 0);
+}
+
+TEMPLATE_TEST_CASE("Merge moves every element over, ours first among equal priorities", "[prqueue][merge]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<64>, prq::compact, prq::persistent) {
+    using Queue = prqueue<string, int, less<int>, TestType>;
+    Queue pq, other;
+    prqueue<string> expected;
+
+    SECTION("Small queue into a large one, and a large one into it") {
+        // Interleaved priorities, so chains are linked in one at a time
+        for (int size : {3, 2000}) {
+            for (int i = 0; i < 500; i++) {
+                pq.enqueue("a" + to_string(size) + "-" + to_string(i), (i * 7) % 50);
+            }
+            for (int i = 0; i < size; i++) {
+                other.enqueue("b" + to_string(size) + "-" + to_string(i), (i * 11) % 60);
+            }
+            expected.clear();
+            Queue copy(pq), otherCopy(other);
+            for (Queue* source : {&copy, &otherCopy}) {
+                source->begin();
+                string value;
+                int priority;
+                for (int n = source->size(); n > 0; n--) {
+                    source->next(value, priority);
+                    expected.enqueue(value, priority);
+                }
+            }
+
+            pq.merge(std::move(other));
+            REQUIRE(other.size() == 0);
+            REQUIRE(pq.size() == expected.size());
+            REQUIRE(pq.toString() == expected.toString());
+
+            // Both queues keep working
+            other.enqueue("again", 1);
+            REQUIRE(other.dequeue() == "again");
+            pq.enqueue("late", 10);
+            expected.enqueue("late", 10);
+            for (int i = 0; i < 100; i++) {
+                REQUIRE(pq.dequeue() == expected.dequeue());
+            }
+        }
+        while (expected.size() > 0) {
+            REQUIRE(pq.dequeue() == expected.dequeue());
+        }
+    }
+
+    SECTION("Priority ranges that do not overlap") {
+        for (int i = 0; i < 300; i++) {
+            pq.enqueue("mid" + to_string(i), 20 + i % 10);
+            other.enqueue("high" + to_string(i), 40 + i % 20);
+        }
+        pq.merge(std::move(other));
+        for (int i = 0; i < 500; i++) {
+            other.enqueue("low" + to_string(i), i % 15);
+        }
+        pq.merge(std::move(other));
+        REQUIRE(pq.size() == 1100);
+
+        Queue copy(pq);
+        int last = -1;
+        while (copy.size() > 0) {
+            int priority = copy.peekPriority();
+            REQUIRE(priority >= last);
+            last = priority;
+            copy.dequeue();
+        }
+        REQUIRE(pq.dequeue() == "low0");
+        pq.enqueue("again", 30);
+        REQUIRE(pq.size() == 1100);
+    }
+
+    SECTION("Merging with empty queues and itself") {
+        other.enqueue("x", 5);
+        other.enqueue("y", 1);
+        pq.merge(std::move(other));
+        REQUIRE(pq.toString() == "1 value: y\n5 value: x\n");
+
+        pq.merge(std::move(other));
+        pq.merge(std::move(pq));
+        REQUIRE(pq.size() == 2);
+
+        other.merge(std::move(pq));
+        REQUIRE(pq.size() == 0);
+        REQUIRE(other.dequeue() == "y");
+        REQUIRE(other.dequeue() == "x");
+    }
+}
+
+TEMPLATE_TEST_CASE("Split moves everything below the bound into a new queue", "[prqueue][split]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<64>, prq::compact, prq::persistent) {
+    using Queue = prqueue<string, int, less<int>, TestType>;
+    Queue pq;
+    for (int i = 0; i < 60; i++) {
+        pq.enqueue("v" + to_string(i), (i * 7) % 30);
+    }
+    // A duplicate chain right at the boundary, enqueued in between the others
+    for (int i = 0; i < 5; i++) {
+        pq.enqueue("d" + to_string(i), 12);
+    }
+    Queue copy(pq);
+    prqueue<string> below, rest;
+    copy.begin();
+    string value;
+    int priority;
+    for (int n = copy.size(); n > 0; n--) {
+        copy.next(value, priority);
+        (priority < 12 ? below : rest).enqueue(value, priority);
+    }
+
+    SECTION("The chain at the bound stays, in FIFO order") {
+        Queue lower = pq.split(12);
+        REQUIRE(lower.size() == below.size());
+        REQUIRE(pq.size() == rest.size());
+        REQUIRE(lower.toString() == below.toString());
+        REQUIRE(pq.toString() == rest.toString());
+    }
+
+    SECTION("A bound just past the chain takes all of it") {
+        Queue lower = pq.split(13);
+        REQUIRE(lower.size() == 31);
+        REQUIRE(pq.size() == 34);
+        REQUIRE(pq.peekPriority() == 13);
+        for (int i = 0; i < 24; i++) {
+            lower.dequeue();
+        }
+        REQUIRE(lower.dequeue() == "v6");
+        REQUIRE(lower.dequeue() == "v36");
+        REQUIRE(lower.dequeue() == "d0");
+        REQUIRE(lower.dequeue() == "d1");
+    }
+
+    SECTION("Bounds outside the priorities take nothing or everything") {
+        Queue none = pq.split(0);
+        REQUIRE(none.size() == 0);
+        REQUIRE(pq.size() == 65);
+
+        Queue all = pq.split(100);
+        REQUIRE(all.size() == 65);
+        REQUIRE(pq.size() == 0);
+        REQUIRE(all.toString() == copy.toString());
+
+        // Both queues keep working
+        pq.enqueue("again", 3);
+        all.enqueue("late", 3);
+        REQUIRE(pq.dequeue() == "again");
+        REQUIRE(all.split(4).size() == 9);
+    }
+}
+
+TEMPLATE_TEST_CASE("Splitting and merging back over and over keeps FIFO order", "[prqueue][split][merge]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<64>, prq::compact, prq::persistent) {
+    prqueue<int, int, less<int>, TestType> pq;
+    for (int i = 0; i < 10; i++) {
+        pq.enqueue(i, 5);
+    }
+    // Enough rounds to wrap a counter that doubled on every merge
+    for (int round = 0; round < 200; round++) {
+        auto lower = pq.split(6);
+        pq.merge(std::move(lower));
+    }
+    pq.enqueue(99, 5);
+    for (int i = 0; i < 10; i++) {
+        REQUIRE(pq.dequeue() == i);
+    }
+    REQUIRE(pq.dequeue() == 99);
+}
+
+TEMPLATE_TEST_CASE("Extract_range takes [lo, hi) out in queue order", "[prqueue][split]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<64>, prq::compact, prq::persistent) {
+    using Queue = prqueue<string, int, less<int>, TestType>;
+    Queue pq;
+    prqueue<string> inside, outside;
+    for (int i = 0; i < 200; i++) {
+        int priority = (i * 13) % 40;
+        pq.enqueue(to_string(i), priority);
+        (priority >= 10 && priority < 25 ? inside : outside).enqueue(to_string(i), priority);
+    }
+
+    vector<string> taken;
+    pq.extract_range(10, 25, back_inserter(taken));
+    REQUIRE(int(taken.size()) == inside.size());
+    for (const string& value : taken) {
+        REQUIRE(value == inside.dequeue());
+    }
+    REQUIRE(pq.toString() == outside.toString());
+
+    SECTION("Empty and reversed ranges take nothing") {
+        taken.clear();
+        pq.extract_range(10, 25, back_inserter(taken));
+        pq.extract_range(30, 30, back_inserter(taken));
+        pq.extract_range(35, 5, back_inserter(taken));
+        REQUIRE(taken.empty());
+        REQUIRE(pq.size() == outside.size());
+    }
+
+    SECTION("A range covering everything empties the queue") {
+        taken.clear();
+        pq.extract_range(-5, 1000, back_inserter(taken));
+        REQUIRE(pq.size() == 0);
+        REQUIRE(int(taken.size()) == outside.size());
+        REQUIRE(taken.front() == outside.peek());
+        pq.enqueue("again", 7);
+        REQUIRE(pq.dequeue() == "again");
+    }
+}
+
+// Output iterator that takes `left` values and throws on the next one
+struct FailingOutput {
+    int* left;
+    vector<string>* taken;
+
+    FailingOutput& operator*() {
+        return *this;
+    }
+
+    FailingOutput& operator++() {
+        return *this;
+    }
+
+    FailingOutput& operator=(string value) {
+        if ((*left)-- == 0) {
+            throw runtime_error("output full");
+        }
+        taken->push_back(std::move(value));
+        return *this;
+    }
+};
+
+TEMPLATE_TEST_CASE("Extract_range leaves a valid queue when the output throws", "[prqueue][split]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<64>, prq::compact, prq::persistent) {
+    using Queue = prqueue<string, int, less<int>, TestType>;
+    Queue pq;
+    prqueue<string> outside;
+    for (int i = 0; i < 200; i++) {
+        int priority = (i * 13) % 40;
+        pq.enqueue(to_string(i), priority);
+        if (priority < 10 || priority >= 25) {
+            outside.enqueue(to_string(i), priority);
+        }
+    }
+
+    // Five elements per priority, so the output gives out inside one
+    int left = 32;
+    vector<string> taken;
+    REQUIRE_THROWS_AS(pq.extract_range(10, 25, FailingOutput{&left, &taken}), runtime_error);
+    REQUIRE(taken.size() == 32);
+
+    // Whatever of the range is left, the rest of the queue is untouched
+    // and every element still queued can be dequeued
+    prqueue<string> kept;
+    int size = pq.size();
+    for (int n = 0; n < size; n++) {
+        int priority = pq.peekPriority();
+        string value = pq.dequeue();
+        if (priority < 10 || priority >= 25) {
+            kept.enqueue(value, priority);
+        }
+    }
+    REQUIRE(pq.size() == 0);
+    REQUIRE(kept.toString() == outside.toString());
+    pq.enqueue("again", 12);
+    REQUIRE(pq.dequeue() == "again");
+}
+
+TEMPLATE_TEST_CASE("Split relinks NODEs without allocating", "[prqueue][split]",
+                   prq::bst, prq::red_black, prq::ranked) {
+    using Queue = prqueue<string, int, less<int>, TestType, CountingAllocator<string>>;
+    liveNodes = 0;
+    {
+        Queue pq;
+        vector<typename Queue::handle> handles;
+        for (int i = 0; i < 1000; i++) {
+            handles.push_back(pq.enqueue(to_string(i), (i * 37) % 100));
+        }
+
+        int before = allocations;
+        Queue lower = pq.split(50);
+        REQUIRE(allocations == before);
+        REQUIRE(liveNodes == 1000);
+        REQUIRE(lower.size() == 500);
+        REQUIRE(pq.size() == 500);
+
+        // Handles follow their elements into the split-off queue
+        lower.update_priority(handles[1], -1);
+        REQUIRE(lower.peek() == "1");
+        pq.erase(handles[2]);
+        REQUIRE(pq.size() == 499);
+    }
+    REQUIRE(liveNodes == 0);
+}
+
+TEMPLATE_TEST_CASE("Merge relinks NODEs without allocating", "[prqueue][merge]",
+                   prq::bst, prq::red_black, prq::ranked, prq::buckets<64>) {
+    using Queue = prqueue<string, int, less<int>, TestType, CountingAllocator<string>>;
+    liveNodes = 0;
+    {
+        Queue pq, other;
+        for (int i = 0; i < 1000; i++) {
+            pq.enqueue(to_string(i), i % 40);
+            other.enqueue(to_string(i), i % 30);
+        }
+        other.merge(Queue());
+
+        int before = allocations;
+        pq.merge(std::move(other));
+        REQUIRE(allocations == before);
+        REQUIRE(liveNodes == 2000);
+        REQUIRE(pq.size() == 2000);
+        REQUIRE(pq.peek() == "0");
+    }
+    REQUIRE(liveNodes == 0);
+}
+
+TEMPLATE_TEST_CASE("Handles follow their elements through a merge", "[prqueue][merge][handle]",
+                   prq::bst, prq::red_black, prq::ranked) {
+    prqueue<string, int, less<int>, TestType> pq, other;
+    pq.enqueue("mine", 5);
+    auto moved = other.enqueue("theirs", 5);
+    auto low = other.enqueue("low", 1);
+
+    pq.merge(std::move(other));
+    REQUIRE(moved.value() == "theirs");
+    pq.update_priority(low, 9);
+    pq.erase(moved);
+    REQUIRE(pq.toString() == "5 value: mine\n9 value: low\n");
+}
+
+TEMPLATE_TEST_CASE("Count, contains and rank answer by priority", "[prqueue][rank]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<64>, prq::compact, prq::persistent) {
+    prqueue<string, int, less<int>, TestType> pq;
+    REQUIRE(pq.count(3) == 0);
+    REQUIRE_FALSE(pq.contains(3));
+    REQUIRE(pq.rank(3) == 0);
+
+    // Priorities 0 to 19, five elements each
+    for (int i = 0; i < 100; i++) {
+        pq.enqueue(to_string(i), (i * 7) % 20);
+    }
+    REQUIRE(pq.count(5) == 5);
+    REQUIRE(pq.contains(19));
+    REQUIRE_FALSE(pq.contains(20));
+    REQUIRE(pq.count(-1) == 0);
+    REQUIRE(pq.count(100) == 0);
+    REQUIRE(pq.rank(0) == 0);
+    REQUIRE(pq.rank(5) == 25);
+    REQUIRE(pq.rank(5) + pq.count(5) == 30);
+    REQUIRE(pq.rank(20) == 100);
+    REQUIRE(pq.rank(-3) == 0);
+    REQUIRE(pq.rank(1000) == 100);
+
+    // All of priority 0 and two of priority 1 leave
+    for (int i = 0; i < 7; i++) {
+        pq.dequeue();
+    }
+    REQUIRE_FALSE(pq.contains(0));
+    REQUIRE(pq.count(1) == 3);
+    REQUIRE(pq.rank(5) == 18);
+
+    pq.enqueue("late", 5);
+    REQUIRE(pq.count(5) == 6);
+    REQUIRE(pq.rank(6) == 24);
+}
+
+TEMPLATE_TEST_CASE("Lower_bound and upper_bound find priorities in the tree", "[prqueue][rank][iterator]",
+                   prq::bst, prq::red_black, prq::ranked) {
+    prqueue<string, int, less<int>, TestType> pq;
+    REQUIRE(pq.lower_bound(1) == pq.end());
+
+    pq.enqueue("c", 30);
+    pq.enqueue("b1", 20);
+    pq.enqueue("a", 10);
+    pq.enqueue("b2", 20);
+
+    auto found = pq.lower_bound(20);
+    REQUIRE(found->value == "b1");
+    ++found;
+    REQUIRE(found->value == "b2");
+    REQUIRE(pq.lower_bound(15)->value == "b1");
+    REQUIRE(pq.lower_bound(0) == pq.cbegin());
+    REQUIRE(pq.lower_bound(31) == pq.end());
+
+    // The next priority up
+    REQUIRE(pq.upper_bound(20)->priority == 30);
+    REQUIRE(pq.upper_bound(5)->value == "a");
+    REQUIRE(pq.upper_bound(30) == pq.end());
+    REQUIRE(distance(pq.lower_bound(20), pq.upper_bound(20)) == pq.count(20));
+}
+
+TEST_CASE("Ranked engine keeps its counts through every operation", "[prqueue][rank]") {
+    using Queue = prqueue<int, int, less<int>, prq::ranked>;
+    using Expected = prqueue<int, int, less<int>, prq::red_black>;
+    Expected expected;
+    Queue pq;
+    map<int, pair<Queue::handle, Expected::handle>> live;  // By value
+    unsigned long long state = 11;
+    auto rng = [&state] {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return unsigned(state >> 33);
+    };
+    auto forget = [&live](const vector<int>& values) {
+        for (int value : values) {
+            live.erase(value);
+        }
+    };
+
+    for (int i = 0; i < 20000; i++) {
+        unsigned op = rng() % 100;
+        int priority = int(rng() % 200);
+        if (op < 45 || live.empty()) {
+            live[i] = {pq.enqueue(i, priority), expected.enqueue(i, priority)};
+        } else if (op < 60) {
+            int value = expected.dequeue();
+            REQUIRE(pq.dequeue() == value);
+            live.erase(value);
+        } else if (op < 80) {
+            auto picked = live.lower_bound(int(rng() % i));
+            if (picked == live.end()) {
+                picked = live.begin();
+            }
+            if (op < 70) {
+                pq.update_priority(picked->second.first, priority);
+                expected.update_priority(picked->second.second, priority);
+            } else {
+                pq.erase(picked->second.first);
+                expected.erase(picked->second.second);
+                live.erase(picked);
+            }
+        } else if (op < 90) {
+            // Handles stay valid through split and merge
+            auto lower = pq.split(priority);
+            auto expectedLower = expected.split(priority);
+            REQUIRE(lower.size() == expectedLower.size());
+            pq.merge(std::move(lower));
+            expected.merge(std::move(expectedLower));
+        } else if (op < 95) {
+            vector<int> taken, expectedTaken;
+            pq.extract_range(priority, priority + 10, back_inserter(taken));
+            expected.extract_range(priority, priority + 10, back_inserter(expectedTaken));
+            REQUIRE(taken == expectedTaken);
+            forget(taken);
+        } else {
+            vector<int> taken, expectedTaken;
+            pq.dequeue_n(5, back_inserter(taken));
+            expected.dequeue_n(5, back_inserter(expectedTaken));
+            REQUIRE(taken == expectedTaken);
+            forget(taken);
+        }
+
+        int probe = int(rng() % 210);
+        REQUIRE(pq.rank(probe) == expected.rank(probe));
+        REQUIRE(pq.count(probe) == expected.count(probe));
+    }
+    REQUIRE(pq.size() == expected.size());
+    REQUIRE(pq.toString() == expected.toString());
+
+    Queue copy(pq);
+    REQUIRE(copy.rank(100) == expected.rank(100));
+}
+
+TEMPLATE_TEST_CASE("Write_to and operator<< stream the toString text", "[prqueue][tostring]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<64>, prq::compact, prq::persistent) {
+    prqueue<int, int, less<int>, TestType> pq;
+    REQUIRE(pq.toString() == "");
+
+    // Enough lines to go past one 64 KiB chunk of write_to
+    ostringstream expected;
+    for (int i = 0; i < 20000; i++) {
+        pq.enqueue(i % 3 == 0 ? -i : i * 1000, i % 50);
+    }
+    int value;
+    int priority;
+    pq.begin();
+    for (bool more = true; more; ) {
+        more = pq.next(value, priority);
+        expected << priority << " value: " << value << endl;
+    }
+    REQUIRE(pq.toString() == expected.str());
+
+    ostringstream written;
+    pq.write_to(written);
+    REQUIRE(written.str() == expected.str());
+
+    ostringstream streamed;
+    streamed << pq << "end";
+    REQUIRE(streamed.str() == expected.str() + "end");
+}
+
+TEST_CASE("ToString formats other types like an ostream", "[prqueue][tostring]") {
+    prqueue<char, double> letters;
+    letters.enqueue('b', 2.5);
+    letters.enqueue('a', -0.125);
+    letters.enqueue('c', 1e20);
+    REQUIRE(letters.toString() == "-0.125 value: a\n2.5 value: b\n1e+20 value: c\n");
+
+    prqueue<const char*, long long, less<long long>, prq::compact> words;
+    words.enqueue("late", 9000000000LL);
+    words.enqueue("early", LLONG_MIN);
+    REQUIRE(words.toString() == "-9223372036854775808 value: early\n9000000000 value: late\n");
+
+    prqueue<bool, unsigned char, less<unsigned char>, prq::dary_heap<4>> flags;
+    flags.enqueue(true, 'x');
+    flags.enqueue(false, 'y');
+    REQUIRE(flags.toString() == "x value: 1\ny value: 0\n");
+}
+
+TEMPLATE_TEST_CASE("Save and load round-trip a snapshot", "[prqueue][snapshot]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<64>, prq::compact, prq::persistent) {
+    using Queue = prqueue<string, int, less<int>, TestType>;
+    const string path = "prqueue_snapshot_test.bin";
+
+    // Built in bulk, the way load() builds every engine
+    vector<pair<string, int>> entries;
+    for (int i = 0; i < 1000; i++) {
+        entries.emplace_back(string(i % 7, 'x') + to_string(i), (i * 37) % 50);
+    }
+    Queue pq(entries.begin(), entries.end());
+
+    SECTION("Contents and FIFO order of equal priorities survive") {
+        pq.save(path);
+        Queue loaded;
+        loaded.enqueue("replaced", 3);
+        loaded.load(path);
+        REQUIRE(loaded == pq);
+        REQUIRE(loaded.size() == 1000);
+        REQUIRE(loaded.toString() == pq.toString());
+
+        // The loaded queue works like any other
+        loaded.enqueue("late", 60);
+        REQUIRE(loaded.size() == 1001);
+        while (pq.size() > 0) {
+            REQUIRE(loaded.dequeue() == pq.dequeue());
+        }
+        REQUIRE(loaded.dequeue() == "late");
+    }
+
+    SECTION("An empty queue round-trips") {
+        Queue empty;
+        empty.save(path);
+        pq.load(path);
+        REQUIRE(pq.size() == 0);
+        REQUIRE(pq == empty);
+    }
+
+    SECTION("Bad files throw and leave the queue as it was") {
+        Queue before(pq);
+        REQUIRE_THROWS_AS(pq.load("no_such_snapshot.bin"), runtime_error);
+        REQUIRE(pq == before);
+
+        // Cut the last record short
+        pq.save(path);
+        string bytes;
+        {
+            ifstream in(path, ios::binary);
+            bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        }
+        {
+            ofstream out(path, ios::binary | ios::trunc);
+            out.write(bytes.data(), streamsize(bytes.size() - 3));
+        }
+        REQUIRE_THROWS_AS(pq.load(path), runtime_error);
+        REQUIRE(pq == before);
+
+        // Same file read back with another value type
+        pq.save(path);
+        prqueue<long long, int, less<int>, TestType> other;
+        REQUIRE_THROWS_AS(other.load(path), runtime_error);
+
+        {
+            ofstream out(path, ios::binary | ios::trunc);
+            out << "not a snapshot at all";
+        }
+        REQUIRE_THROWS_AS(pq.load(path), runtime_error);
+        REQUIRE(pq == before);
+    }
+    remove(path.c_str());
+}
+
+// Payload with its own snapshot format
+struct Job {
+    int id;
+    vector<string> tags;
+
+    bool operator==(const Job& other) const {
+        return id == other.id && tags == other.tags;
+    }
+
+    bool operator!=(const Job& other) const {
+        return !(*this == other);
+    }
+};
+
+namespace prq {
+template<>
+struct serializer<Job> {
+    static constexpr uint32_t width = 0;
+
+    static void write(string& out, const Job& job) {
+        serializer<int>::write(out, job.id);
+        serializer<uint64_t>::write(out, job.tags.size());
+        for (const string& tag : job.tags) {
+            serializer<string>::write(out, tag);
+        }
+    }
+
+    static Job read(const char*& in, const char* end) {
+        Job job{serializer<int>::read(in, end), {}};
+        uint64_t tags = serializer<uint64_t>::read(in, end);
+        for (uint64_t i = 0; i < tags; i++) {
+            job.tags.push_back(serializer<string>::read(in, end));
+        }
+        return job;
+    }
+};
+}
+
+TEST_CASE("Snapshots use prq::serializer for values and priorities", "[prqueue][snapshot]") {
+    const string path = "prqueue_snapshot_test.bin";
+    prqueue<Job, double, greater<double>, prq::red_black> pq;
+    pq.enqueue(Job{1, {"a", "b"}}, 0.5);
+    pq.enqueue(Job{2, {}}, 2.25);
+    pq.enqueue(Job{3, {"c"}}, 0.5);
+    pq.save(path);
+
+    prqueue<Job, double, greater<double>, prq::red_black> loaded;
+    loaded.load(path);
+    REQUIRE(loaded == pq);
+    REQUIRE(loaded.dequeue().id == 2);
+    REQUIRE(loaded.dequeue().tags == vector<string>{"a", "b"});
+    REQUIRE(loaded.dequeue().id == 3);
+    remove(path.c_str());
+}
+
+TEMPLATE_TEST_CASE("Equality compares contents whatever order they arrived in", "[prqueue][equality]",
+                   prq::bst, prq::red_black, prq::ranked,
+                   prq::dary_heap<4>, prq::buckets<8>, prq::compact, prq::persistent) {
+    using Queue = prqueue<string, int, less<int>, TestType>;
+    Queue ascending, descending;
+    for (int i = 0; i < 8; i++) {
+        ascending.enqueue("a" + to_string(i), i);
+        ascending.enqueue("b" + to_string(i), i);
+    }
+    for (int i = 7; i >= 0; i--) {
+        descending.enqueue("a" + to_string(i), i);
+    }
+    for (int i = 0; i < 8; i++) {
+        descending.enqueue("b" + to_string(i), i);
+    }
+    REQUIRE(ascending == descending);
+    REQUIRE(ascending.hash_code() == descending.hash_code());
+    REQUIRE(hash<Queue>()(ascending) == hash<Queue>()(descending));
+
+    SECTION("Reaching the same contents through dequeues") {
+        Queue longer(descending);
+        longer.enqueue("gone", 0);
+        descending.dequeue();
+        descending.enqueue("gone", 0);
+        longer.dequeue();
+        longer.dequeue();
+        descending.dequeue();
+        REQUIRE_FALSE(longer == ascending);
+        REQUIRE(longer == descending);
+        REQUIRE(longer.hash_code() == descending.hash_code());
+    }
+
+    SECTION("Tie order, values and priorities all count") {
+        Queue swapped;
+        for (int i = 0; i < 8; i++) {
+            swapped.enqueue("b" + to_string(i), i);
+            swapped.enqueue("a" + to_string(i), i);
+        }
+        REQUIRE_FALSE(swapped == ascending);
+
+        Queue renamed(ascending), moved(ascending);
+        renamed.dequeue();
+        renamed.enqueue("c0", 0);
+        moved.dequeue();
+        moved.enqueue("a0", 7);
+        descending.dequeue();
+        descending.enqueue("a0", 0);
+        REQUIRE_FALSE(renamed == descending);
+        REQUIRE_FALSE(moved == descending);
+        REQUIRE(renamed.hash_code() != descending.hash_code());
+        REQUIRE(moved.hash_code() != descending.hash_code());
+    }
+
+    SECTION("Queues key unordered containers") {
+        unordered_set<Queue> seen;
+        seen.insert(ascending);
+        REQUIRE(seen.count(descending) == 1);
+        descending.dequeue();
+        REQUIRE(seen.count(descending) == 0);
+        REQUIRE(Queue().hash_code() == Queue().hash_code());
+    }
+}
+
+TEMPLATE_TEST_CASE("Content hash stays exact through every change", "[prqueue][equality]",
+                   prq::bst, prq::red_black, prq::ranked) {
+    using Queue = prqueue<int, int, less<int>, TestType>;
+    mt19937 rng(24);
+    Queue pq;
+    vector<typename Queue::handle> handles;
+    auto rebuilt = [](const Queue& queue) {
+        vector<pair<int, int>> entries;
+        for (const auto& entry : queue) {
+            entries.emplace_back(entry.value, entry.priority);
+        }
+        return Queue(entries.begin(), entries.end());
+    };
+
+    for (int i = 0; i < 3000; i++) {
+        unsigned op = rng() % 100;
+        int priority = int(rng() % 50);
+        if (op < 50 || pq.size() == 0) {
+            handles.push_back(pq.enqueue(i, priority));
+        } else if (op < 60) {
+            pq.dequeue();
+            handles.clear();
+        } else if (op < 75 && !handles.empty()) {
+            size_t picked = rng() % handles.size();
+            if (op < 68) {
+                pq.update_priority(handles[picked], priority);
+            } else {
+                pq.erase(handles[picked]);
+                handles.erase(handles.begin() + picked);
+            }
+        } else if (op < 85) {
+            Queue lower = pq.split(priority);
+            REQUIRE(lower.hash_code() == rebuilt(lower).hash_code());
+            REQUIRE(pq.hash_code() == rebuilt(pq).hash_code());
+            pq.merge(std::move(lower));
+        } else if (op < 92) {
+            vector<int> taken;
+            pq.extract_range(priority, priority + 5, back_inserter(taken));
+            handles.clear();
+        } else {
+            vector<int> taken;
+            pq.dequeue_n(3, back_inserter(taken));
+            handles.clear();
+        }
+
+        if (i % 50 == 0) {
+            Queue copy = rebuilt(pq);
+            REQUIRE(pq.hash_code() == copy.hash_code());
+            REQUIRE(pq == copy);
+        }
+    }
+}
+
+TEST_CASE("Persistent copies are snapshots that later changes do not reach", "[prqueue][persistent]") {
+    using Queue = prqueue<string, int, less<int>, prq::persistent, CountingAllocator<string>>;
+    liveNodes = 0;
+    {
+        Queue pq;
+        for (int i = 0; i < 10000; i++) {
+            pq.enqueue(to_string(i), (i * 37) % 1000);
+        }
+        string original = pq.toString();
+
+        // Copying shares every NODE
+        int before = allocations;
+        Queue snapshot(pq);
+        Queue another;
+        another = pq;
+        REQUIRE(allocations == before);
+        REQUIRE(liveNodes == 10000);
+        REQUIRE(snapshot == pq);
+
+        // A change clones only the shared NODEs on its path
+        pq.enqueue("new", 500);
+        pq.dequeue();
+        REQUIRE(allocations - before < 200);
+        REQUIRE(snapshot.toString() == original);
+        REQUIRE(another == snapshot);
+        REQUIRE_FALSE(pq == snapshot);
+        REQUIRE(pq.size() == 10000);
+        REQUIRE(pq.count(500) == snapshot.count(500) + 1);
+
+        // Changes to a snapshot do not reach the original either
+        string changed = pq.toString();
+        vector<string> taken;
+        snapshot.extract_range(100, 200, back_inserter(taken));
+        REQUIRE(taken.size() == 1000);
+        Queue lower = another.split(500);
+        REQUIRE(lower.size() == 5000);
+        REQUIRE(pq.toString() == changed);
+        REQUIRE(another.size() == 5000);
+
+        // Once the snapshots are gone the NODEs are changed in place again
+        snapshot.clear();
+        another.clear();
+        lower.clear();
+        REQUIRE(liveNodes == 10000);
+        before = allocations;
+        for (int i = 0; i < 100; i++) {
+            pq.enqueue("late", i);
+            pq.dequeue();
+        }
+        REQUIRE(allocations - before == 100);
+        REQUIRE(liveNodes == 10000);
+    }
+    REQUIRE(liveNodes == 0);
+}
+
+TEST_CASE("Persistent snapshots are read on another thread while the queue changes", "[prqueue][persistent]") {
+    prqueue<string, int, less<int>, prq::persistent> live;
+    mutex lock;
+    atomic<bool> done(false);
+    atomic<int> inspected(0);
+    atomic<bool> consistent(true);
+
+    thread monitor([&] {
+        while (!done && consistent) {
+            prqueue<string, int, less<int>, prq::persistent> snapshot;
+            {
+                lock_guard<mutex> guard(lock);
+                snapshot = live;
+            }
+            // The snapshot holds still: its text has one line per element,
+            // and it drains in queue order
+            int n = snapshot.size();
+            string text = snapshot.toString();
+            consistent = consistent && count(text.begin(), text.end(), '\n') == n;
+            int last = INT_MIN;
+            while (snapshot.size() > n / 2) {
+                consistent = consistent && snapshot.peekPriority() >= last;
+                last = snapshot.peekPriority();
+                snapshot.dequeue();
+            }
+            inspected++;
+        }
+    });
+
+    for (int i = 0; (i < 20000 || inspected < 10) && consistent; i++) {
+        lock_guard<mutex> guard(lock);
+        live.enqueue(to_string(i), i % 97);
+        if (i % 3 == 0) {
+            live.dequeue();
+        }
+    }
+    done = true;
+    monitor.join();
+    REQUIRE(consistent);
+    REQUIRE(inspected >= 10);
+}